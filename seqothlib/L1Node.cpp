@@ -5,6 +5,13 @@
 #include <thread>
 #include <zlib.h>
 #include <future>
+#include <algorithm>
+#include <numeric>
+#include <mutex>
+#include <condition_variable>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
 using namespace std;
 
 L1Node::~L1Node() {
@@ -12,6 +19,11 @@ L1Node::~L1Node() {
         delete othellos[i];
     }
     othellos.clear();
+    // replicas[0] are the parts of othellos, see replicate().
+    for (uint32_t n = 1; n < replicas.size(); n++)
+        for (auto *p : replicas[n])
+            delete p;
+    replicas.clear();
     for (uint32_t i = 0 ; i <kV.size(); i++) {
         delete kV[i];
         delete vV[i];
@@ -21,7 +33,21 @@ L1Node::~L1Node() {
 }
 
 void L1Node::add(uint64_t &k, uint16_t v) {
-    uint32_t grp = (k)>>(shift);
+    uint32_t grp;
+    if (balanced) {
+        if (bounds.empty()) {
+            bounds.assign(grpidlimit, UINT64_MAX);
+            bounds[0] = 0;
+        }
+        else if (k < lastKey)
+            throw std::invalid_argument("keys must be added in order to a balanced L1");
+        grp = partOf(lastKey);
+        if (kV[grp]->size() >= partTarget && grp + 1 < grpidlimit && k != lastKey)
+            bounds[++grp] = k;
+        lastKey = k;
+    }
+    else
+        grp = (k)>>(shift);
     if (grp >= grpidlimit)
         throw std::invalid_argument("invalid key to put in L1");
     kV[grp]->push_back(k);
@@ -29,28 +55,119 @@ void L1Node::add(uint64_t &k, uint16_t v) {
 }
 
 uint64_t L1Node::queryInt(uint64_t k) {
-    uint32_t grp = (k)>>(shift);
-    if (othellos[grp] == NULL)
+    uint32_t grp = partOf(k);
+    const vector<Othello<uint64_t> *> &parts = localParts();
+    if (parts[grp] == NULL)
         return 0;
-    return othellos[grp]->queryInt(k);
+    return parts[grp]->queryInt(k);
+}
+
+//! the buffers of L1Node::queryBatch(), kept by each thread, so that a batch allocates nothing once they are large enough.
+struct L1BatchScratch {
+    vector<uint32_t> start, grps, pos, fill;
+    vector<uint64_t> keys, values;
+};
+static thread_local L1BatchScratch batchScratch;
+
+void L1Node::queryBatch(const uint64_t *k, size_t n, uint64_t *out) {
+    if (n == 0) return;
+    const vector<Othello<uint64_t> *> &parts = localParts();
+    // bucket the keys by partition, so that each partition is queried with Othello::queryBatch.
+    L1BatchScratch &s = batchScratch;
+    s.grps.resize(n);
+    bool onePart = true;
+    for (size_t i = 0; i < n; i++) {
+        s.grps[i] = partOf(k[i]);
+        onePart &= (s.grps[i] == s.grps[0]);
+    }
+    if (onePart) {
+        if (parts[s.grps[0]] == NULL)
+            fill_n(out, n, 0);
+        else
+            parts[s.grps[0]]->queryBatch(k, n, out);
+        return;
+    }
+    s.start.assign(grpidlimit+1, 0);
+    for (size_t i = 0; i < n; i++)
+        s.start[s.grps[i]+1]++;
+    for (uint32_t g = 0; g < grpidlimit; g++)
+        s.start[g+1] += s.start[g];
+    s.pos.resize(n);
+    s.keys.resize(n);
+    s.values.resize(n);
+    s.fill.assign(s.start.begin(), s.start.end()-1);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t t = s.fill[s.grps[i]]++;
+        s.keys[t] = k[i];
+        s.pos[t] = i;
+    }
+    for (uint32_t g = 0; g < grpidlimit; g++) {
+        uint32_t cnt = s.start[g+1] - s.start[g];
+        if (cnt == 0) continue;
+        if (parts[g] == NULL)
+            fill_n(&s.values[s.start[g]], cnt, 0);
+        else
+            parts[g]->queryBatch(&s.keys[s.start[g]], cnt, &s.values[s.start[g]]);
+    }
+    for (size_t t = 0; t < n; t++)
+        out[s.pos[t]] = s.values[t];
+}
+
+/*!
+ \brief the value width of part *id*, which is at most *L*.
+ \note if the distinct values of the part, with 0, need fewer bits as codes than the largest value, the values are replaced by their codes,
+  and the values are put in *valueMap*. Code 0 stands for value 0.
+ */
+uint32_t L1Node::partValueWidth(uint32_t id, uint32_t L, vector<uint64_t> &valueMap) {
+    valueMap.clear();
+    uint16_t *v = vV[id]->getstart();
+    size_t n = vV[id]->size();
+    vector<bool> seen(65536, false);
+    for (size_t i = 0; i < n; i++)
+        seen[v[i]] = true;
+    // code 0 is always value 0, so that the cells left at 0 still query as absent.
+    vector<uint64_t> values(1, 0);
+    for (uint32_t x = 1; x < seen.size(); x++)
+        if (seen[x])
+            values.push_back(x);
+    uint32_t lmax = 1, lcode = 1;
+    while ((1ULL << lmax) <= values.back()) lmax++;
+    while ((1ULL << lcode) < values.size()) lcode++;
+    if (lcode >= lmax)
+        return min(lmax, L);
+    vector<uint16_t> code(65536, 0);
+    for (uint32_t i = 0; i < values.size(); i++)
+        code[values[i]] = i;
+    for (size_t i = 0; i < n; i++)
+        v[i] = code[v[i]];
+    valueMap.swap(values);
+    return lcode;
 }
 
-void L1Node::constructothello(uint32_t id, uint32_t L, string fname) {
+void L1Node::constructothello(uint32_t id, uint32_t L, string fname, uint32_t threads) {
     Othello<uint64_t> * othello = NULL;
-    printf("%s : start to construct L1 Node part %u\n", get_thid().c_str(), id);
-    if (kV[id]->size())
-        othello = new Othello<uint64_t>(L, *kV[id], *vV[id], true, 200);
+    printf("%s : start to construct L1 Node part %u with %u threads\n", get_thid().c_str(), id, threads);
+    if (kV[id]->size()) {
+        vector<uint64_t> valueMap;
+        uint32_t partL = partValueWidth(id, L, valueMap);
+        printf("%s : L1 part %u has values of %u bits, %lu mapped values\n", get_thid().c_str(), id, partL, valueMap.size());
+        if (hashes == 3)
+            othello = new Othello3<uint64_t>(partL, *kV[id], *vV[id], true, 200);
+        else
+            othello = new Othello<uint64_t>(partL, *kV[id], *vV[id], true, 200, threads, blockbytes);
+        othello->setValueMap(valueMap);
+    }
     printf("%s : Write to Gzip File %s.%d\n", get_thid().c_str(),fname.c_str(),id);
     char cbuf[0x400];
     memset(cbuf,0,sizeof(cbuf));
     sprintf(cbuf,"%s.%d",fname.c_str(), id);
-    gzFile fout = gzopen(cbuf, "wb");
+    gzFile fout = gzopen(cbuf, "wbT");
     unsigned char buf[0x20];
     memset(buf,0,sizeof(buf));
     if (kV[id]->size()) {
         othello->exportInfo(buf);
         gzwrite(fout, buf, sizeof(buf));
-        othello->writeDataToGzipFile(fout);
+        othello->writeDataToMappableFile(fout);
         kV[id]->release();
         vV[id]->release();
     }
@@ -61,51 +178,242 @@ void L1Node::constructothello(uint32_t id, uint32_t L, string fname) {
     delete othello;
     printf("%s : L1 part %u consturction finished.\n", get_thid().c_str(), id);
 }
+/*!
+ \brief build and write all parts, the largest first.
+ \note parts with at least L1BigPartlimit keys are built one at a time with *threads* threads. The others are
+  dispatched to *threads* workers, and a part starts only when the estimated memory of the parts in construction stays within buildMemoryBytes.
+ */
 void L1Node::constructAndWrite(uint32_t L, uint32_t threads, string fname) {
-    vector<thread> vthreadL1;
-    uint64_t curreintInQ = 0;
+    vector<uint32_t> order(grpidlimit);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return kV[a]->size() > kV[b]->size();
+    });
+    size_t next = 0;
+    //! large parts are built first, one at a time, each using all threads.
+    while (threads > 1 && next < order.size() && kV[order[next]]->size() >= L1BigPartlimit)
+        constructothello(order[next++], L, fname, threads);
 
-    for (uint32_t i = 0 ; i < grpidlimit; i++) {
-        if (curreintInQ  > L1InQlimit || vthreadL1.size()>= threads) {
-            for (auto &th : vthreadL1)
-                th.join();
-            vthreadL1.clear();
-            curreintInQ = 0;
+    uint64_t budget = buildMemoryBytes ? buildMemoryBytes : L1InQlimit * L1BuildBytesPerKey;
+    uint64_t inflight = 0;
+    mutex mtx;
+    condition_variable cv;
+    auto worker = [&]() {
+        while (true) {
+            uint32_t id;
+            uint64_t bytes;
+            {
+                unique_lock<mutex> lock(mtx);
+                if (next >= order.size())
+                    return;
+                id = order[next];
+                bytes = kV[id]->size() * L1BuildBytesPerKey;
+                //! a part larger than the budget is built alone.
+                cv.wait(lock, [&]() {
+                    return next >= order.size() || order[next] != id || inflight == 0 || inflight + bytes <= budget;
+                });
+                if (next >= order.size() || order[next] != id)
+                    continue;
+                next++;
+                inflight += bytes;
+            }
+            cv.notify_all();
+            constructothello(id, L, fname, 1);
+            {
+                lock_guard<mutex> lock(mtx);
+                inflight -= bytes;
+            }
+            cv.notify_all();
         }
-        curreintInQ += kV[i]->size();
-        vthreadL1.push_back(std::thread(&L1Node::constructothello, this, i, L, fname));
-    }
+    };
+    vector<thread> vthreadL1;
+    for (uint32_t i = 0; i < max(threads, 1U); i++)
+        vthreadL1.push_back(thread(worker));
     for (auto &th : vthreadL1)
         th.join();
 }
-void L1Node::loadFromFile(string fname) {
+Othello<uint64_t> * L1Node::loadPart(string fname, uint32_t id) {
+    char cbuf[0x400];
+    memset(cbuf,0,sizeof(cbuf));
+    sprintf(cbuf,"%s.%d",fname.c_str(), id);
+    return loadPartFile(cbuf);
+}
+
+Othello<uint64_t> * L1Node::loadPartFile(const char *cbuf) {
+    gzFile fin = gzopen(cbuf, "rb");
+    if (fin == NULL) {
+        fprintf(stderr,"failed to open L1 part %s\n", cbuf);
+        return NULL;
+    }
+    unsigned char buf[0x20];
+    memset(buf,0,sizeof(buf));
+    gzread(fin, buf,sizeof(buf));
+    unsigned char buf0[0x20];
+    memset(buf0,0,sizeof(buf0));
+    Othello<uint64_t> *oth = NULL;
+    if (memcmp(buf, buf0, 0x20) !=0) {
+        oth = new Othello<uint64_t> (buf);
+        oth->loadDataFromFile(fin, cbuf);
+        if (!oth->loaded) {
+            delete oth;
+            oth = NULL;
+        }
+    }
+    gzclose(fin);
+    return oth;
+}
+
+/*!
+ \brief load the part *partname*, through the shared cache in *dir* if the part can not be mapped.
+ \note a cached file is valid if it is not older than its part. Its modification time is updated on use, for evictSharedCache().
+ */
+Othello<uint64_t> * L1Node::loadPartShared(const char *partname, const string &dir, uint64_t budget) {
+    gzFile fin = gzopen(partname, "rb");
+    if (fin == NULL)
+        return loadPartFile(partname);
+    unsigned char buf[0x20];
+    bool direct = (gzread(fin, buf, sizeof(buf)) == sizeof(buf)) && gzdirect(fin);
+    gzclose(fin);
+    if (direct)
+        return loadPartFile(partname);
+    char rbuf[PATH_MAX];
+    string cname = (realpath(partname, rbuf) != NULL) ? string(rbuf) : string(partname);
+    replace(cname.begin(), cname.end(), '/', '_');
+    cname = dir + "/seqoth_L1" + cname;
+    struct stat ps, cs;
+    if (stat(partname, &ps) == 0 && stat(cname.c_str(), &cs) == 0 && cs.st_mtime >= ps.st_mtime) {
+        Othello<uint64_t> *oth = loadPartFile(cname.c_str());
+        if (oth != NULL) {
+            utime(cname.c_str(), NULL);
+            return oth;
+        }
+    }
+    Othello<uint64_t> *oth = loadPartFile(partname);
+    if (oth == NULL)
+        return NULL;
+    string tmp = cname + ".tmp" + to_string(getpid());
+    gzFile fout = gzopen(tmp.c_str(), "wbT");
+    if (fout == NULL)
+        return oth;
+    oth->exportInfo(buf);
+    gzwrite(fout, buf, sizeof(buf));
+    oth->writeDataToMappableFile(fout);
+    if (gzclose(fout) != Z_OK || rename(tmp.c_str(), cname.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return oth;
+    }
+    printf("%s : L1 part %s is cached as %s\n", get_thid().c_str(), partname, cname.c_str());
+    evictSharedCache(dir, budget, cname);
+    Othello<uint64_t> *mapped = loadPartFile(cname.c_str());
+    if (mapped == NULL)
+        return oth;
+    delete oth;
+    return mapped;
+}
+
+//! \brief remove the least recently used parts cached in *dir*, except *keep*, until they take at most *budget* bytes.
+void L1Node::evictSharedCache(const string &dir, uint64_t budget, const string &keep) {
+    if (budget == 0)
+        return;
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return;
+    vector<pair<time_t, pair<uint64_t, string>>> files;
+    uint64_t tot = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "seqoth_L1", 9) != 0 || strstr(e->d_name, ".tmp") != NULL)
+            continue;
+        string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+        files.push_back(make_pair(st.st_mtime, make_pair((uint64_t) st.st_size, path)));
+        tot += st.st_size;
+    }
+    closedir(d);
+    sort(files.begin(), files.end());
+    //! a removed file stays valid for the processes mapping it.
+    for (auto &f : files) {
+        if (tot <= budget) break;
+        if (f.second.second == keep) continue;
+        if (unlink(f.second.second.c_str()) == 0)
+            tot -= f.second.first;
+    }
+}
+
+//! \brief the part *grp*, either the loaded one of othellos, or a new one read from its file, to be deleted after use.
+Othello<uint64_t> * L1Node::loadPart(uint32_t grp) {
+    if (grp < othellos.size() && othellos[grp] != NULL)
+        return othellos[grp];
+    char cbuf[0x400];
+    memset(cbuf,0,sizeof(cbuf));
+    sprintf(cbuf,"%s.%d",fname.c_str(), grp);
+    if (!sharedCacheDir.empty())
+        return loadPartShared(cbuf, sharedCacheDir, sharedCacheBytes);
+    return loadPartFile(cbuf);
+}
+
+void L1Node::loadFromFile(string fname, unsigned int threads) {
+    ThreadPool pool(threads, 1024);
+    std::vector<std::future<int>> results;
+    loadFromFile(fname, pool, results);
+    for (auto && result: results)
+        result.get();
+}
+
+void L1Node::loadFromFile(string fname, ThreadPool &pool, vector<std::future<int>> &results, int priority) {
     grpidlimit = (1<<splitbit);
     othellos.resize(grpidlimit);
     for (uint32_t i = 0 ; i < grpidlimit; i++) {
-        char cbuf[0x400];
-        memset(cbuf,0,sizeof(cbuf));
-        sprintf(cbuf,"%s.%d",fname.c_str(), i);
-        gzFile fin = gzopen(cbuf, "rb");
-        unsigned char buf[0x20];
-        gzread(fin, buf,sizeof(buf));
-        unsigned char buf0[0x20];
-        memset(buf0,0,sizeof(buf0));
-        if (memcmp(buf, buf0, 0x20) ==0) {
-            othellos[i] = NULL;
-        }
-        else {
-            othellos[i] = new Othello<uint64_t> (buf);
-            othellos[i]->loadDataFromGzipFile(fin);
-            if (!othellos[i]->loaded) {
-                delete othellos[i];
-                othellos[i] = NULL;
-            }
-        }
-        gzclose(fin);
+        auto lambda = [this, fname, i]() {
+            othellos[i] = loadPart(fname, i);
+            return 0;
+        };
+        results.emplace_back(pool.enqueue(priority, lambda));
+    }
+}
+
+void L1Node::replicate(const vector<int> &nodes) {
+    if (nodes.size() < 2)
+        throw std::invalid_argument("L1 replicas need at least 2 NUMA nodes");
+    replicas.assign(nodes.size(), vector<Othello<uint64_t> *>(othellos.size(), NULL));
+    replicaOfNode.clear();
+    for (uint32_t r = 0; r < nodes.size(); r++) {
+        if (nodes[r] < 0)
+            throw std::invalid_argument("invalid NUMA node for L1 replicas");
+        if ((uint32_t) nodes[r] >= replicaOfNode.size())
+            replicaOfNode.resize(nodes[r] + 1, -1);
+        replicaOfNode[nodes[r]] = r;
+    }
+    vector<thread> vthread;
+    for (uint32_t r = 0; r < nodes.size(); r++) {
+        int node = nodes[r];
+        vthread.push_back(thread([this, r, node]() {
+            if (!pinToNumaNode(node))
+                printf("%s : failed to pin to NUMA node %d\n", get_thid().c_str(), node);
+            for (uint32_t i = 0; i < othellos.size(); i++)
+                if (othellos[i] != NULL)
+                    replicas[r][i] = othellos[i]->replicateOnNode(node);
+            printf("%s : L1 replicated on NUMA node %d\n", get_thid().c_str(), node);
+        }));
+    }
+    for (auto &th : vthread)
+        th.join();
+    // the originals are not queried any more, the replicas of the first node take their place.
+    for (uint32_t i = 0; i < othellos.size(); i++) {
+        delete othellos[i];
+        othellos[i] = replicas[0][i];
     }
 }
 
 void L1Node::putInfoToXml(tinyxml2::XMLElement *pe, string fname) {
+    if (!bounds.empty()) {
+        stringstream ss;
+        for (unsigned int i = 0 ; i < bounds.size(); i++)
+            ss << (i ? " " : "") << hex << bounds[i];
+        pe->SetAttribute("Boundaries", ss.str().c_str());
+    }
     for (unsigned int i = 0 ; i < grpidlimit; i++)
         if (kV[i]->size()) {
             auto pNode = pe->GetDocument()->NewElement("L1NodePart");
@@ -114,6 +422,8 @@ void L1Node::putInfoToXml(tinyxml2::XMLElement *pe, string fname) {
             sprintf(cbuf,"%s.%d",fname.c_str(), i);
             pNode->SetAttribute("Filename", cbuf);
             pNode->SetAttribute("KeyCount", (uint32_t) kV[i]->size());
+            pNode->SetAttribute("BlockBytes", blockbytes);
+            pNode->SetAttribute("Hashes", hashes);
             pe->InsertEndChild(pNode);
         }
 }
@@ -135,60 +445,61 @@ void L1Node::setfname(string str) {
     fname = str;
 }
 
-int queryThreadInPool(Othello<uint64_t> &oth, vector<vector<uint16_t>> &ans, const vector<vector<uint64_t>> &kmers, const unsigned int grp, const unsigned int st, const unsigned int ed, const uint32_t shift) {
-    printf("Query L1 grp %d for transcripts from %d to %d\n", grp,st,ed-1);
-    int totcnt = 0;
-    for (unsigned int i = st ; i < ed; i++)
-        for (unsigned int j = 0 ; j < (kmers)[i].size(); j++)
-            if (grp == ((kmers)[i][j] >> shift)) {
-                totcnt++;
-                (ans)[i][j] = oth.queryInt((kmers)[i][j]);
-            }
-    return totcnt;
+int queryThreadInPool(Othello<uint64_t> &oth, const uint64_t *keys, uint16_t * const *dst, const unsigned int grp, const size_t st, const size_t ed) {
+    printf("Query L1 grp %d for k-mers from %lu to %lu\n", grp, st, ed-1);
+    vector<uint64_t> values(ed - st);
+    oth.queryBatch(keys + st, ed - st, &values[0]);
+    for (size_t t = st ; t < ed; t++)
+        *dst[t] = values[t - st];
+    return ed - st;
 }
-void L1Node::queryPartAndPutToVV(vector<vector<uint16_t>> &ans, vector<vector<uint64_t>> &kmers, unsigned int grp, unsigned int threads) {
+void L1Node::queryPartAndPutToVV(const uint64_t *keys, uint16_t * const *dst, size_t n, unsigned int grp, unsigned int threads) {
     if (grp >= (1U<<splitbit))
         throw std::invalid_argument("Error group id for L1");
-
-    ThreadPool pool(threads, 1024);
-
-    char cbuf[0x400];
-    memset(cbuf,0,sizeof(cbuf));
-    sprintf(cbuf,"%s.%d",fname.c_str(), grp);
-    gzFile fin = gzopen(cbuf, "rb");
-    unsigned char buf[0x20];
-    gzread(fin, buf,sizeof(buf));
-    unsigned char buf0[0x20];
-    memset(buf0,0,sizeof(buf0));
-    Othello<uint64_t> *oth;
-    if (memcmp(buf, buf0, 0x20) ==0) {
+    if (n == 0)
         return;
-    }
-    else {
-        oth = new Othello<uint64_t> (buf);
-        oth->loadDataFromGzipFile(fin);
-        if (!oth->loaded) {
-            delete oth;
-            return;
-        }
-    }
+    Othello<uint64_t> *oth = loadPart(grp);
+    if (oth == NULL)
+        return;
+    ThreadPool pool(threads, 1024);
     int maxs = 32;
-    vector<int> loc;
+    vector<size_t> loc;
     for (int i = 0 ; i<=maxs; i++)
-        loc.push_back(kmers.size()*i/maxs);
+        loc.push_back(n*i/maxs);
     std::vector<std::future<int>> results;
     for (int thd = 0; thd < maxs; thd++)  {
-        int st = loc[thd];
-        int ed = loc[thd+1];
+        size_t st = loc[thd];
+        size_t ed = loc[thd+1];
         if (st == ed) continue;
         auto lambda = std::bind(queryThreadInPool,
-                                std::ref(*oth), std::ref(ans), std::ref(kmers), (grp), (st), (ed), (shift));
+                                std::ref(*oth), keys, dst, (grp), (st), (ed));
         std::future<int> x = pool.enqueue(thd, lambda);
         results.emplace_back(std::move(x));
     }
     for (auto && result: results)
         result.get();
 
-    delete oth;
+    if (grp >= othellos.size() || othellos[grp] != oth)
+        delete oth;
     return;
 }
+void L1Node::queryByPartAndPutToVV(vector<vector<uint16_t>> &ans, vector<vector<uint64_t>> &kmers, unsigned int threads) {
+    //! counting sort of the k-mers by part, keeping the destination of each k-mer.
+    vector<size_t> bstart((1ULL<<splitbit) + 1, 0);
+    for (auto &vk : kmers)
+        for (auto k : vk)
+            bstart[partOf(k) + 1]++;
+    for (uint32_t g = 0; g < (1U<<splitbit); g++)
+        bstart[g + 1] += bstart[g];
+    vector<uint64_t> keys(bstart.back());
+    vector<uint16_t *> dst(bstart.back());
+    vector<size_t> cur(bstart.begin(), bstart.end() - 1);
+    for (size_t i = 0; i < kmers.size(); i++)
+        for (size_t j = 0; j < kmers[i].size(); j++) {
+            size_t p = cur[partOf(kmers[i][j])]++;
+            keys[p] = kmers[i][j];
+            dst[p] = &ans[i][j];
+        }
+    for (uint32_t g = 0; g < (1U<<splitbit); g++)
+        queryPartAndPutToVV(keys.data() + bstart[g], dst.data() + bstart[g], bstart[g + 1] - bstart[g], g, threads);
+}
@@ -8,19 +8,55 @@
 using namespace std;
 
 class L1Node {
-    void constructothello(uint32_t, uint32_t, string);
+    void constructothello(uint32_t, uint32_t, string, uint32_t);
+    uint32_t partValueWidth(uint32_t id, uint32_t L, vector<uint64_t> &valueMap);
+    static Othello<uint64_t> * loadPart(string fname, uint32_t id);
+    static Othello<uint64_t> * loadPartFile(const char *partname);
+    static Othello<uint64_t> * loadPartShared(const char *partname, const string &dir, uint64_t budget);
+    static void evictSharedCache(const string &dir, uint64_t budget, const string &keep);
 private:
     uint32_t splitbit;
     uint32_t shift;
     string fname;
+    vector<uint64_t> bounds; //!< the smallest key of each part, if the parts are balanced, otherwise empty.
+    uint64_t lastKey = 0;
+    vector<vector<Othello<uint64_t> *>> replicas; //!< replicas[r] are the parts allocated on the NUMA node replicaNodes[r], see replicate().
+    vector<int> replicaOfNode; //!< the index in replicas of each NUMA node id, -1 for the nodes without a replica.
+    //! \brief the parts to query, the replicas of the NUMA node of the calling thread if any, otherwise those of the first node.
+    inline const vector<Othello<uint64_t> *> & localParts() const {
+        if (replicas.empty())
+            return othellos;
+        uint32_t node = currentNumaNode();
+        if (node < replicaOfNode.size() && replicaOfNode[node] >= 0)
+            return replicas[replicaOfNode[node]];
+        return replicas[0];
+    }
+    Othello<uint64_t> * loadPart(uint32_t grp);
 public:
     uint32_t kmerLength;
     vector<Othello<uint64_t> *> othellos;
     vector<IOBuf<uint64_t> *> kV;
     vector<IOBuf<uint16_t> *> vV;
     uint32_t grpidlimit;
+    uint32_t blockbytes = 0; //!< layout of the parts, see Othello::blockbytes.
+    uint32_t hashes = 2; //!< 3 to build the parts as Othello3.
+    /*!
+     \brief if set before add(), the keys must be added in increasing order, and a part is closed when it holds its share of the estimated keys,
+      instead of splitting the keys by their highest bits. The boundaries must then be given to setBoundaries() to query the parts.
+     */
+    bool balanced = false;
+    uint64_t partTarget = 0; //!< keys per part of a balanced L1 node, the estimated key count divided by the number of parts.
+    uint64_t buildMemoryBytes = 0; //!< estimated memory of the parts built at once by constructAndWrite(), 0 for L1InQlimit keys.
+    /*!
+     \brief if not empty, a part that can not be mapped, i.e., a compressed one, is inflated once to a mappable file in this directory,
+      e.g., under /dev/shm, and later queries of this and other processes map it from there.
+     */
+    string sharedCacheDir;
+    uint64_t sharedCacheBytes = 0; //!< the least recently used files of sharedCacheDir are removed above this many bytes, 0 for no limit.
     constexpr static uint64_t L1Partlimit = 1048576*128;
-    constexpr static uint64_t L1InQlimit = 1048576*512;
+    constexpr static uint64_t L1InQlimit = 1048576*512; //!< keys of the parts built at once, if buildMemoryBytes is 0.
+    constexpr static uint64_t L1BuildBytesPerKey = 40; //!< estimated peak memory per key of building a part, including its keys and values.
+    constexpr static uint64_t L1BigPartlimit = 1048576*16; //!< parts with more keys are built with multiple threads.
     L1Node() {}
     L1Node(uint64_t estimatedKmerCount, int _kmerlength, const string &buf) : kmerLength(_kmerlength) {
         splitbit = 0;
@@ -41,14 +77,25 @@ public:
             vV.push_back(new IOBuf<uint16_t>((fstr+".values").c_str()));
         }
         othellos.resize(grpidlimit);
+        partTarget = estimatedKmerCount / grpidlimit + 1;
     }
 
     uint64_t queryInt(uint64_t k);
+    void queryBatch(const uint64_t *k, size_t n, uint64_t *out);
     void add(uint64_t &k, uint16_t v);
     void writeToFile(string fname);
     ~L1Node();
     void constructAndWrite(uint32_t, uint32_t, string);
-    void loadFromFile(string fname);
+    /*!
+     \brief copy the loaded parts to each NUMA node of *nodes*, at least 2 of them, e.g., numaNodesWithCPUs(), by a thread pinned to the node.
+     \note queryInt() and queryBatch() then use the replica of the node of the calling thread, which should be pinned by pinToNumaNode().
+      The loaded parts are freed, and othellos then holds the replicas of the first node.
+     */
+    void replicate(const vector<int> &nodes);
+    //! \brief load all parts of *fname*, *threads* parts at a time.
+    void loadFromFile(string fname, unsigned int threads = 1);
+    //! \brief enqueue the loads of the parts of *fname* to *pool*, with priority *priority*, and append their futures to *results*.
+    void loadFromFile(string fname, ThreadPool &pool, vector<std::future<int>> &results, int priority = 0);
     void putInfoToXml(tinyxml2::XMLElement *, string);
     void setsplitbit(uint32_t _kmerlength, uint32_t t) {
         kmerLength = _kmerlength;
@@ -58,9 +105,36 @@ public:
     uint32_t getsplitbit() {
         return splitbit;
     }
+    //! \brief the part of key *k*, by a branch-free binary search of the boundaries of a balanced L1 node.
+    inline uint32_t partOf(uint64_t k) const {
+        if (bounds.empty())
+            return k >> shift;
+        uint32_t g = 0;
+        for (uint32_t step = (1U << splitbit) >> 1; step; step >>= 1)
+            g += (bounds[g + step] <= k) ? step : 0;
+        return g;
+    }
+    //! \brief the smallest key of each part, one per part, or none if the parts are split by the highest bits.
+    const vector<uint64_t> & getBoundaries() const {
+        return bounds;
+    }
+    void setBoundaries(const vector<uint64_t> &b) {
+        if (!b.empty() && b.size() != (1ULL << splitbit))
+            throw std::invalid_argument("invalid L1 boundaries");
+        bounds = b;
+    }
     map<int, double> printrates();
     void setfname(string);
-    void queryPartAndPutToVV(vector<vector<uint16_t>> &ans, vector<vector<uint64_t>> &kmers, unsigned int grp, unsigned int threads);
+    /*!
+     \brief query the *n* k-mers *keys* of the part *grp*, and put the result of keys[i] to *dst[i].
+     \note the part is loaded, unless it is already in othellos, queried by *threads* threads, and then released, see sharedCacheDir.
+     */
+    void queryPartAndPutToVV(const uint64_t *keys, uint16_t * const *dst, size_t n, unsigned int grp, unsigned int threads);
+    /*!
+     \brief query all k-mers of *kmers*, and put the results to *ans*, which has the same shape as *kmers*.
+     \note the k-mers are bucketed by part in one pass, and then each part is loaded once and queried with its own bucket.
+     */
+    void queryByPartAndPutToVV(vector<vector<uint16_t>> &ans, vector<vector<uint64_t>> &kmers, unsigned int threads);
 };
 
 
@@ -2,18 +2,6 @@
 #include "L2Node.hpp"
 
 
-inline uint8_t get4b(uint8_t **pp, bool &hasvalue, uint8_t &buff) {
-    if (hasvalue) {
-        hasvalue = false;
-        (*pp)++;
-        return buff;
-    }
-    else {
-        buff = ((**pp)>>4);
-        hasvalue = true;
-        return (**pp) & 0xF;
-    }
-}
 inline void put4b(uint8_t **pp, bool &filledhalf, uint8_t val) {
     if (filledhalf) {
         (**pp) |= ((val & 0xF)<<4);
@@ -24,51 +12,228 @@ inline void put4b(uint8_t **pp, bool &filledhalf, uint8_t val) {
         filledhalf = true;
     }
 }
-inline uint32_t getvalue(uint8_t **pp, bool & hasvalue, uint8_t &buff, bool & finished) {
-    uint8_t v = get4b(pp, hasvalue, buff);
-    if (v & 0x8) {
-        if (v == 8) finished = true;
-        return (v&0x7);
-    }
-    uint32_t v2 = get4b(pp, hasvalue, buff);
-    if (v & 0x4) {
-        uint32_t a = (v & 0x3);
-        return ( (a<<4) | v2);
-    }
-    uint32_t v3 = get4b(pp, hasvalue, buff);
-    if (v & 0x2) {
-        uint32_t a = (v & 0x1);
-        return ( (a<<8) | (v2<<4) | v3);
+
+/*
+ * The value list is a stream of 4-bit codes, the low half of each byte first. The first code of a value gives its length:
+ *   1xxx             : xxx, 1000 ends the list.
+ *   01xx yyyy        : xxyyyy.
+ *   001x yyyy zzzz   : xyyyyzzzz.
+ *   0001 ...         : 12 bits in the next 3 codes.
+ *   0000 ...         : 20 bits in the next 5 codes.
+ * A value 1 is followed by the length of the run of 1s.
+ * The decoder below keeps the codes in a 64-bit word, and decodes a value by tables indexed by its first code, without
+ * a branch on its length. The word of the next value is loaded while the current one is decoded.
+ */
+namespace {
+//! the length of a value, in codes, indexed by its first code, 4 bits each.
+const uint64_t codeLength = 0x1111111122223346ULL;
+//! the shift and the mask of a value in the code-reversed word, indexed by its first code.
+const uint8_t codeShift[16] = {8, 16, 20, 20, 24, 24, 24, 24, 28, 28, 28, 28, 28, 28, 28, 28};
+const uint32_t codeMask[16] = {0xFFFFF, 0xFFF, 0x1FF, 0x1FF, 0x3F, 0x3F, 0x3F, 0x3F, 7, 7, 7, 7, 7, 7, 7, 7};
+
+//! the 8 bytes from *byte* of *p* on, without reading past *maxmem* bytes.
+inline uint64_t loadCodes(const uint8_t *p, uint32_t byte, uint32_t maxmem) {
+    uint64_t w = 0;
+    if (byte >= maxmem)
+        return 0;
+    if (maxmem - byte >= 8)
+        memcpy(&w, p + byte, 8);
+    else if (maxmem >= 8) {
+        memcpy(&w, p + maxmem - 8, 8);
+        w >>= (8 - (maxmem - byte)) << 3;
+    }
+    else
+        for (uint32_t i = byte; i < maxmem; i++)
+            w |= (uint64_t) p[i] << ((i - byte) << 3);
+    return w;
+}
+
+//! the value starting at the lowest code of *w*, and its length in *len*.
+inline uint32_t codeValue(uint64_t w, uint32_t &len) {
+    uint32_t c = w & 0xF;
+    len = (codeLength >> (c << 2)) & 0xF;
+    // reverse the order of the codes, so that the value is a bit field.
+    uint32_t r = __builtin_bswap32((uint32_t) w);
+    r = ((r >> 4) & 0x0F0F0F0F) | ((r & 0x0F0F0F0F) << 4);
+    return (r >> codeShift[c]) & codeMask[c];
+}
+
+/*!
+ \brief the values of the two codes in a byte, if both codes are short.
+ \note an entry is count | codes << 8 | first << 16 | second << 24, and it is 0 if the first value is longer than 2 codes,
+ is 1 followed by a run longer than a code, or is the end of the list. A run of 1s has *count* 1s, whose gaps are 1.
+ */
+struct ShortCodes {
+    uint32_t step[256];
+    ShortCodes() {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint32_t lo = b & 0xF, hi = b >> 4;
+            uint32_t count = 0, codes = 0, first = 0, second = 0;
+            if (lo >= 4 && lo < 8 && (((lo & 3) << 4) | hi) != 1) {
+                count = 1;
+                codes = 2;
+                first = ((lo & 3) << 4) | hi;
+            }
+            else if (lo == 9 && hi > 8) {
+                count = hi & 7;
+                codes = 2;
+                first = second = 1;
+            }
+            else if (lo > 9) {
+                count = codes = 1;
+                first = lo & 7;
+                if (hi > 9) {
+                    count = codes = 2;
+                    second = hi & 7;
+                }
+            }
+            step[b] = count | (codes << 8) | (first << 16) | (second << 24);
+        }
     }
-    uint32_t v4 = get4b(pp, hasvalue, buff);
-    if (v == 1) {
-        return (v2<<8) | (v3<<4) | v4;
+};
+const ShortCodes shortCodes;
+
+//! puts the decoded values to a vector.
+struct VectorSink {
+    vector<uint32_t> &val;
+    size_t n = 0;
+    uint32_t *out;
+    VectorSink(vector<uint32_t> &v, uint32_t maxmem) : val(v) {
+        // a value takes at least one code, except for the runs of 1s, see room().
+        if (val.size() < 2 * (size_t) maxmem + 8)
+            val.resize(2 * (size_t) maxmem + 8);
+        out = &val[0];
+    }
+    inline void put(uint32_t v) {
+        out[n++] = v;
+    }
+    //! put *a*, and *b* if *count* is 2.
+    inline void putPair(uint32_t a, uint32_t b, uint32_t count) {
+        out[n] = a;
+        out[n + 1] = b;
+        n += count;
+    }
+    inline void room(size_t extra) {
+        if (n + extra > val.size()) {
+            val.resize(max(val.size() * 2, n + extra));
+            out = &val[0];
+        }
     }
-    uint32_t v5 = get4b(pp, hasvalue, buff);
-    uint32_t v6 = get4b(pp, hasvalue, buff);
-    return ( (v2<<16) | (v3<<12) | (v4<<8) | (v5<<4) | v6);
+    uint32_t finish() {
+        val.resize(n);
+        return n;
+    }
+};
+
+//! counts the decoded values below *limit*.
+struct CountSink {
+    int *counts;
+    uint32_t limit;
+    uint32_t n = 0;
+    CountSink(int *c, uint32_t l) : counts(c), limit(l) {}
+    inline void put(uint32_t v) {
+        n++;
+        if (v < limit)
+            counts[v]++;
+    }
+    inline void putPair(uint32_t a, uint32_t b, uint32_t count) {
+        put(a);
+        if (count == 2)
+            put(b);
+    }
+    inline void room(size_t) {}
+    uint32_t finish() {
+        return n;
+    }
+};
+
+//! put the short values of the entry *e* of shortCodes to *sink*.
+template <bool sum, typename Sink>
+inline void putShortCodes(uint32_t e, uint32_t &last, Sink &sink, uint32_t maxmem) {
+    uint32_t count = e & 0xFF;
+    uint32_t first = (e >> 16) & 0xFF, second = e >> 24;
+    if (count <= 2) {
+        uint32_t a = sum ? last + first : first;
+        uint32_t b = sum ? a + second : second;
+        sink.putPair(a, b, count);
+        last = (count == 2) ? b : a;
+        return;
+    }
+    sink.room(count + 2 * (size_t) maxmem + 8);
+    for (; count > 0; count--)
+        sink.put(sum ? ++last : 1);
 }
-uint32_t valuelistDecode(uint8_t *p, vector<uint32_t> &val, uint32_t maxmem) {
-    uint8_t **pp = &p;
-    val.clear();
-    bool hasvalue = false;
-    uint8_t buff = 0;
-    bool finished = false;;
-    while ( *pp < (p+maxmem) ) {
-        uint32_t x = getvalue(pp, hasvalue, buff,finished);
-        if (finished)
-            return val.size();
-        val.push_back(x);
-        if (x == 1) {
-            uint32_t dup = getvalue(pp, hasvalue, buff, finished);
-            while (dup > 1) {
-                val.push_back(1);
-                dup--;
+
+//! decode the gaps of the list at *p* to *sink*, or their running sums if *sum*.
+template <bool sum, typename Sink>
+inline uint32_t decodeValueList(const uint8_t *p, uint32_t maxmem, Sink &sink) {
+    uint32_t pos = 0; //!< the first code of w.
+    uint32_t last = 0;
+    uint64_t w = loadCodes(p, 0, maxmem);
+    while ((pos >> 1) < maxmem) {
+        // at least 9 codes of it are left for the next value, after up to 4 short codes.
+        uint64_t next = loadCodes(p, pos >> 1, maxmem);
+        uint32_t e = shortCodes.step[w & 0xFF];
+        uint32_t len = (e >> 8) & 0xFF;
+        if (e != 0) {
+            // up to two bytes of short codes in a step, the second looked up for either length of the first.
+            uint32_t e1 = shortCodes.step[(w >> 4) & 0xFF];
+            uint32_t e2 = shortCodes.step[(w >> 8) & 0xFF];
+            putShortCodes<sum>(e, last, sink, maxmem);
+            e = (len == 1) ? e1 : e2;
+            if (e != 0) {
+                putShortCodes<sum>(e, last, sink, maxmem);
+                len += (e >> 8) & 0xFF;
+            }
+            if (len == 4) {
+                // a dense row, where the branch is predicted and the next step does not wait for the table.
+                w = next >> (((pos & 1) + 4) << 2);
+                pos += 4;
+            }
+            else {
+                w = next >> (((pos & 1) + len) << 2);
+                pos += len;
             }
+            continue;
+        }
+        if ((w & 0xF) == 8)
+            break;
+        uint32_t x = codeValue(w, len);
+        last = sum ? last + x : x;
+        sink.put(last);
+        w = next >> (((pos & 1) + len) << 2);
+        pos += len;
+        if (x == 1) {
+            if ((w & 0xF) == 8)
+                break;
+            uint32_t dup = codeValue(w, len);
+            pos += len;
+            w = loadCodes(p, pos >> 1, maxmem) >> ((pos & 1) << 2);
+            // keep room for a value per code left.
+            sink.room(dup + 2 * (size_t) maxmem + 8);
+            for (; dup > 1; dup--)
+                sink.put(sum ? ++last : 1);
         }
     }
-    return val.size();
+    return sink.finish();
+}
+}
+
+uint32_t valuelistDecode(uint8_t *p, vector<uint32_t> &val, uint32_t maxmem) {
+    VectorSink sink(val, maxmem);
+    return decodeValueList<false>(p, maxmem, sink);
+}
+
+uint32_t valuelistDecodeSum(const uint8_t *p, vector<uint32_t> &val, uint32_t maxmem) {
+    VectorSink sink(val, maxmem);
+    return decodeValueList<true>(p, maxmem, sink);
+}
+
+uint32_t valuelistCount(const uint8_t *p, uint32_t maxmem, int *counts, uint32_t limit) {
+    CountSink sink(counts, limit);
+    return decodeValueList<true>(p, maxmem, sink);
 }
+
 inline void putvalue(uint32_t x, uint8_t **pp, bool &filledhalf, bool really, uint32_t & ans) {
     if (x>0xFFF) { //>12bits
         if (really) {
@@ -143,6 +308,48 @@ uint32_t valuelistEncode(uint8_t *p, vector<uint32_t> &val, bool really) {
     return (ans>>1) + (ans & 1);
 }
 
+uint64_t RowDedup::hashRow(const uint8_t *row) const {
+    uint64_t h = rowbytes;
+    for (uint32_t i = 0; i < rowbytes; i += 8) {
+        uint64_t w = 0;
+        memcpy(&w, row + i, min(8U, rowbytes - i));
+        h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+void RowDedup::grow() {
+    vector<uint32_t>(slots.size() * 2, 0).swap(slots);
+    uint64_t m = slots.size() - 1;
+    for (uint32_t r = 0; r < ids.size(); r++) {
+        uint64_t p = hashRow(&arena[(size_t) r * rowbytes]) & m;
+        while (slots[p])
+            p = (p + 1) & m;
+        slots[p] = r + 1;
+    }
+}
+
+uint32_t RowDedup::insert(const uint8_t *row, uint32_t id, bool &fresh) {
+    uint64_t m = slots.size() - 1;
+    uint64_t p = hashRow(row) & m;
+    for (; slots[p]; p = (p + 1) & m) {
+        uint32_t r = slots[p] - 1;
+        if (memcmp(&arena[(size_t) r * rowbytes], row, rowbytes) == 0) {
+            fresh = false;
+            return ids[r];
+        }
+    }
+    fresh = true;
+    arena.insert(arena.end(), row, row + rowbytes);
+    ids.push_back(id);
+    slots[p] = ids.size();
+    // keep the table at most half full.
+    if (ids.size() * 2 > slots.size())
+        grow();
+    return id;
+}
+
 void L2Node::constructOth() {
     uint32_t L = 8;
 
@@ -151,9 +358,13 @@ void L2Node::constructOth() {
     while ((1<<L)<entrycnt+10) L++;
 #pragma GCC diagnostic pop
     printf("%s: construct L2Node with %lu keys. Using type %s. with %u-Othello, entrycnt %u.\n", get_thid().c_str(), keys->size(), L2NodeTypes::typestr.at(this->getType()).c_str(), L, entrycnt);
-    oth = new Othello<keyType> (L, *keys, *values, true, 0);
+    //! the removed keys are kept in the overflow table of the Othello, allow the default number of them instead of rehashing.
+    if (hashes == 3)
+        oth = new Othello3<keyType> (L, *keys, *values, true);
+    else
+        oth = new Othello<keyType> (L, *keys, *values, true, -1, 1, blockbytes);
     for (auto &k: oth->removedKeys) {
-        printf("%s: Removed key vNode %lx\n", get_thid().c_str(), k);
+        printf("%s: Removed key vNode %lx, kept in the overflow table\n", get_thid().c_str(), k);
     }
     keys->release();
     values->release();
@@ -161,11 +372,10 @@ void L2Node::constructOth() {
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
-bool L2ShortValueListNode::smartQuery(const keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
-    uint64_t index = L2Node::oth->queryInt(*k);
+bool L2ShortValueListNode::queryByIndex(uint64_t index, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
     ret.clear();
-    if (index >= uint64list.size()) return true;
-    uint64_t vl = uint64list[index];
+    if (index >= rowcnt) return true;
+    uint64_t vl = row(index);
     uint32_t valcnt = valuecnt;
     while (valcnt -- ) {
         uint32_t pq = vl & mask;
@@ -176,21 +386,12 @@ bool L2ShortValueListNode::smartQuery(const keyType *k, vector<uint32_t> &ret, v
 }
 #pragma GCC diagnostic pop
 
-bool L2EncodedValueListNode::smartQuery(const keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
-    uint64_t index = L2Node::oth->queryInt(*k);
+bool L2EncodedValueListNode::queryByIndex(uint64_t index, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
     if (encodetype == L2NodeTypes::VALUE_INDEX_ENCODED) {
         ret.clear();
         if (IOLengthInBytes*index >= lines.size()) return true;
         if (index==0) return true;
-        vector<uint32_t> decode;
-        valuelistDecode(&lines[IOLengthInBytes*index], decode, IOLengthInBytes);
-        if (decode.size()==0) return true;
-        uint32_t last;
-        ret.push_back(last = decode[0]);
-        for (uint32_t i = 1; i< decode.size(); i++) {
-            last += decode[i];
-            ret.push_back(last);
-        }
+        valuelistDecodeSum(&lines[IOLengthInBytes*index], ret, IOLengthInBytes);
         return true;
     }
     else {
@@ -204,6 +405,45 @@ bool L2EncodedValueListNode::smartQuery(const keyType *k, vector<uint32_t> &ret,
     }
 }
 
+void bitmapAccumulate(const uint8_t *row, uint32_t nbits, int *counts) {
+    uint32_t v = 0;
+#if defined(__AVX2__)
+    // a byte is spread to the 8 lanes, and each lane that has its bit set is -1 after the compare.
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    for (; v + 8 <= nbits; v += 8) {
+        __m256i b = _mm256_set1_epi32(row[v >> 3]);
+        __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(b, bits), bits);
+        __m256i *pc = (__m256i *) (counts + v);
+        _mm256_storeu_si256(pc, _mm256_sub_epi32(_mm256_loadu_si256(pc), set));
+    }
+#endif
+    for (; v < nbits; v++)
+        counts[v] += (row[v >> 3] >> (v & 7)) & 1;
+}
+
+void L2ShortValueListNode::countByIndex(uint64_t index, int *counts, uint32_t limit) {
+    if (index >= rowcnt) return;
+    uint64_t vl = row(index);
+    for (uint32_t valcnt = valuecnt; valcnt; valcnt--) {
+        uint32_t pq = vl & mask;
+        vl >>= maxnl;
+        if (pq < limit)
+            counts[pq]++;
+    }
+}
+
+void L2EncodedValueListNode::countByIndex(uint64_t index, int *counts, uint32_t limit) {
+    if (IOLengthInBytes*index >= lines.size()) return;
+    const uint8_t *row = &lines[IOLengthInBytes*index];
+    if (encodetype == L2NodeTypes::VALUE_INDEX_ENCODED) {
+        if (index==0) return;
+        valuelistCount(row, IOLengthInBytes, counts, limit);
+        return;
+    }
+    //MAPP
+    bitmapAccumulate(row, min(limit, IOLengthInBytes << 3), counts);
+}
+
 void L2ShortValueListNode::add(keyType &k, vector<uint32_t> & valuelist) {
     if (fdata==NULL) {
         fdata = gzopen((gzfname+".dat").c_str(),"wb");
@@ -219,20 +459,22 @@ void L2ShortValueListNode::add(keyType &k, vector<uint32_t> & valuelist) {
         value <<= maxnl;
         value |= (*pval & mask);
     }
-    if (valuemap.count(value) == 0) {
-        //we always prepend one  to avoid \tau result = 0;
-        if (siz == 0) {
-            uint64_t u0 = 0;
-            siz ++;
-            gzwrite(fdata, &u0, IOLengthInBytes);
-        }
-        //}
-        valuemap[value] = siz;
+    //we always prepend one  to avoid \tau result = 0;
+    if (siz == 0) {
+        uint64_t u0 = 0;
+        siz ++;
+        gzwrite(fdata, &u0, IOLengthInBytes);
+    }
+    if (valuemap == NULL)
+        valuemap = new RowDedup(IOLengthInBytes);
+    bool fresh;
+    uint32_t id = valuemap->insert((const uint8_t *) &value, siz, fresh);
+    if (fresh) {
         gzwrite(fdata, &value, IOLengthInBytes);
         siz++;
         entrycnt = siz;
     }
-    values->push_back(valuemap[value]);
+    values->push_back(id);
     keys->push_back(k);
     return;
 
@@ -253,37 +495,21 @@ void L2EncodedValueListNode::add(keyType &k, vector<uint32_t> & valuelist) { //
     keys->push_back(k);
     keycnt++;
     valuelistEncode(&buff[0], valuelist, true);
-    if (IOLengthInBytes<=8) {
-        uint64_t v64 = 0;
-        memcpy(&v64, &buff[0], IOLengthInBytes);
-        if (valuemap.count(v64) ==0) {
-            if (siz == 0) {
-                siz += IOLengthInBytes;
-                entrycnt++;
-                gzwrite(fdata,&buff[0], IOLengthInBytes);
-            }
-            valuemap[v64] = entrycnt;
-            entrycnt++;
-            siz += IOLengthInBytes;
-            gzwrite(fdata,&buff[0], IOLengthInBytes);
-        }
-        values->push_back(valuemap[v64]);
-    }
-    else {
-        if (siz == 0) { //lines.size() == 0) {
-            //lines.resize(IOLengthInBytes);
-            siz += IOLengthInBytes;
-            entrycnt++;
-            gzwrite(fdata,&buff[0], IOLengthInBytes);
-        }
-        //uint32_t curr = lines.size();
-        //lines.resize(lines.size() + IOLengthInBytes);
+    if (siz == 0) { //lines.size() == 0) {
         siz += IOLengthInBytes;
         entrycnt++;
         gzwrite(fdata,&buff[0], IOLengthInBytes);
-        values->push_back(keycnt);
     }
-
+    if (valuemap == NULL)
+        valuemap = new RowDedup(IOLengthInBytes);
+    bool fresh;
+    uint32_t id = valuemap->insert(&buff[0], entrycnt, fresh);
+    if (fresh) {
+        entrycnt++;
+        siz += IOLengthInBytes;
+        gzwrite(fdata,&buff[0], IOLengthInBytes);
+    }
+    values->push_back(id);
 }
 
 void L2EncodedValueListNode::addMAPP(keyType &k, vector<uint8_t> &mapp) {
@@ -297,30 +523,33 @@ void L2EncodedValueListNode::addMAPP(keyType &k, vector<uint8_t> &mapp) {
             return;
         }
     }
+    if (mapp.size() != IOLengthInBytes) {
+        throw invalid_argument("can not add bitmap to L2ShortValuelist type");
+    }
     keys->push_back(k);
-    //TODO :: Need to pre-pend a record for false positives!
     keycnt++;
-    entrycnt++;
+    // the entry 0 is a false positive, with no sample.
     if (siz == 0) { //lines.size() == 0) {
-        //lines.resize(mapp.size());
         siz += IOLengthInBytes;
         vector<uint8_t> buff(IOLengthInBytes);
         gzwrite(fdata,&buff[0], IOLengthInBytes);
         entrycnt++;
     }
-    if (mapp.size() != IOLengthInBytes) {
-        throw invalid_argument("can not add bitmap to L2ShortValuelist type");
+    if (valuemap == NULL)
+        valuemap = new RowDedup(IOLengthInBytes);
+    bool fresh;
+    uint32_t id = valuemap->insert(&mapp[0], entrycnt, fresh);
+    if (fresh) {
+        entrycnt++;
+        siz += IOLengthInBytes;
+        gzwrite(fdata,&mapp[0], IOLengthInBytes);
     }
-    //uint32_t curr = lines.size();
-    //lines.insert(lines.end(), mapp.begin(), mapp.end());
-    gzwrite(fdata,&mapp[0], IOLengthInBytes);
-    values->push_back(keycnt);
-    siz += IOLengthInBytes;
+    values->push_back(id);
 }
 
 void L2ShortValueListNode::writeDataToGzipFile() {
     printf("%s : writing to L2 Gzip File %s\n", get_thid().c_str(), gzfname.c_str());
-    gzFile fout = gzopen(gzfname.c_str(), "wb");
+    gzFile fout = gzopen(gzfname.c_str(), "wbT");
     unsigned char buf[0x20];
     memset(buf,0,sizeof(buf));
     memcpy(buf, &valuecnt, 4);
@@ -329,14 +558,15 @@ void L2ShortValueListNode::writeDataToGzipFile() {
     gzwrite(fout, buf,sizeof(buf));
     L2Node::oth->exportInfo(buf);
     gzwrite(fout, buf,sizeof(buf));
-    L2Node::oth->writeDataToGzipFile(fout);
+    L2Node::oth->writeDataToMappableFile(fout);
     gzclose(fout);
-    uint64list.clear();
-    valuemap.clear();
+    rows.clear();
+    delete valuemap;
+    valuemap = NULL;
     delete L2Node::oth;
     delete keys;
     delete values;
-    //for (auto const & vl: uint64list) {
+    //for (auto const & vl: rows) {
     //  uint64_t rvl = vl;
     //  gzwrite(fdata, &rvl, IOLengthInBytes);
     //}
@@ -345,7 +575,7 @@ void L2ShortValueListNode::writeDataToGzipFile() {
 
 void L2EncodedValueListNode::writeDataToGzipFile() {
     printf("%s: Write L2 Node %s\n", get_thid().c_str(), gzfname.c_str());
-    gzFile fout = gzopen(gzfname.c_str(), "wb");
+    gzFile fout = gzopen(gzfname.c_str(), "wbT");
     unsigned char buf[0x20];
     memset(buf,0,sizeof(buf));
     memcpy(buf, &IOLengthInBytes, 4);
@@ -354,8 +584,10 @@ void L2EncodedValueListNode::writeDataToGzipFile() {
     gzwrite(fout, buf,sizeof(buf));
     L2Node::oth->exportInfo(buf);
     gzwrite(fout, buf,sizeof(buf));
-    L2Node::oth->writeDataToGzipFile(fout);
+    L2Node::oth->writeDataToMappableFile(fout);
     lines.clear();
+    delete valuemap;
+    valuemap = NULL;
     //gzwrite(fdata, &lines[0], lines.size());
     delete L2Node::oth;
     delete keys;
@@ -378,15 +610,18 @@ void L2ShortValueListNode::loadDataFromGzipFile() {
     memcpy(&siz, &buf[8], 4);
     gzread(fin, buf,sizeof(buf));
     L2Node::oth = new Othello<uint64_t> (buf);
-    L2Node::oth->loadDataFromGzipFile(fin);
+    L2Node::oth->loadDataFromFile(fin, gzfname.c_str());
+    definetypes();
     gzFile fin2 = gzopen((gzfname+".dat").c_str(), "rb");
 //    gzbuffer(fin2,256*1024);
-    uint64list.resize(0);//ShortVLcount);
-    for (uint32_t i = 0 ; i < siz; i++) {
-        uint64_t vl = 0ULL;
-        gzread(fin2, &vl, IOLengthInBytes);
-        uint64list.push_back(vl);
-    }
+    uint64_t bytes = (uint64_t) siz * IOLengthInBytes;
+    rows.assign(bytes + sizeof(uint64_t), 0);
+    for (uint64_t done = 0; done < bytes; ) {
+        int r = gzread(fin2, &rows[done], min(bytes - done, (uint64_t) 1 << 30));
+        if (r <= 0) break;
+        done += r;
+    }
+    rowcnt = siz;
     gzclose(fin);
     gzclose(fin2);
 }
@@ -405,7 +640,7 @@ void L2EncodedValueListNode::loadDataFromGzipFile() {
     memcpy(&siz, &buf[8], 4);
     gzread(fin, buf,sizeof(buf));
     L2Node::oth = new Othello<uint64_t> (buf);
-    L2Node::oth->loadDataFromGzipFile(fin);
+    L2Node::oth->loadDataFromFile(fin, gzfname.c_str());
     lines.resize(siz);//ShortVLcount);
     gzFile fin2 = gzopen((gzfname+".dat").c_str(), "rb");
 //    gzbuffer(fin2,256*1024);
@@ -422,6 +657,8 @@ void L2ShortValueListNode::putInfoToXml(tinyxml2::XMLElement * pe) {
     pe->SetAttribute("Keycount", keycnt);
     pe->SetAttribute("EntryCount", entrycnt);
     pe->SetAttribute("L2FileName", gzfname.c_str());
+    pe->SetAttribute("BlockBytes", blockbytes);
+    pe->SetAttribute("Hashes", hashes);
 }
 
 void L2EncodedValueListNode::putInfoToXml(tinyxml2::XMLElement *pe) {
@@ -431,6 +668,8 @@ void L2EncodedValueListNode::putInfoToXml(tinyxml2::XMLElement *pe) {
     pe->SetAttribute("Keycount", keycnt);
     pe->SetAttribute("EntryCount", entrycnt);
     pe->SetAttribute("L2FileName", gzfname.c_str());
+    pe->SetAttribute("BlockBytes", blockbytes);
+    pe->SetAttribute("Hashes", hashes);
 }
 
 
@@ -466,6 +705,10 @@ L2Node::createL2Node( tinyxml2::XMLElement *p, string folder) {
         if (entrycnt)
             ptr = make_shared<L2EncodedValueListNode>(IOL, type,fname);
     }
+    if (ptr) {
+        ptr->blockbytes = p->UnsignedAttribute("BlockBytes", 0);
+        ptr->hashes = p->UnsignedAttribute("Hashes", 2);
+    }
     return ptr;
 }
 
@@ -476,7 +719,7 @@ L2EncodedValueListNode:: getvalcnt() {
 
 uint64_t
 L2ShortValueListNode::getvalcnt() {
-    return uint64list.size() * IOLengthInBytes;
+    return (uint64_t) rowcnt * IOLengthInBytes;
 }
 
 double L2ShortValueListNode::expectedOnes(double &prb) {
@@ -484,7 +727,7 @@ double L2ShortValueListNode::expectedOnes(double &prb) {
     L2Node::oth->getrates(tmap);
     prb = 0;
     double ans = 0;
-    for (unsigned int i = 1 ; i < uint64list.size(); i++) {
+    for (unsigned int i = 1 ; i < rowcnt; i++) {
         ans += tmap[i]*valuecnt;
         prb += tmap[i];
     }
@@ -504,10 +747,10 @@ double L2EncodedValueListNode::expectedOnes(double &prb) {
     }
     double ans = 0;
     prb = 0.0;
+    vector<uint32_t> decode;
     for (unsigned int index = 1; index< lines.size()/IOLengthInBytes; index++) {
         prb += tmap[index];
         if (encodetype == L2NodeTypes::VALUE_INDEX_ENCODED) {
-            vector<uint32_t> decode;
             valuelistDecode(&lines[IOLengthInBytes*index], decode, IOLengthInBytes);
             ans += decode.size()  * tmap[index];
         }
@@ -528,7 +771,7 @@ map<int,double> L2Node::getRates() {
 }
 
 int L2ShortValueListNode::getEntrycnt() {
-    return uint64list.size();
+    return rowcnt;
 }
 
 int L2EncodedValueListNode::getEntrycnt() {
@@ -537,8 +780,8 @@ int L2EncodedValueListNode::getEntrycnt() {
 
 map<int,double> L2ShortValueListNode::computeProb(map<int,double> &p) {
     map<int,double> ret;
-    for (int i = 1; i< uint64list.size(); i++) {
-        uint64_t vl = uint64list[i];
+    for (uint32_t i = 1; i< rowcnt; i++) {
+        uint64_t vl = row(i);
         uint32_t valcnt = valuecnt;
         while (valcnt -- ) {
             uint32_t pq = vl & mask;
@@ -553,15 +796,11 @@ map<int,double> L2EncodedValueListNode::computeProb(map<int,double> &p) {
     map<int,double> ret;
     if (encodetype == L2NodeTypes::VALUE_INDEX_ENCODED) {
         int high = lines.size()/IOLengthInBytes;
+        vector<uint32_t> decode;
         for (int i = 1; i<high; i++) {
-            vector<uint32_t> decode;
-            valuelistDecode(&lines[IOLengthInBytes*i], decode, IOLengthInBytes);
-            if (decode.size()==0) continue;
-            uint32_t last=0;
-            for (uint32_t v = 0; v< decode.size(); v++) {
-                last += decode[v];
-                ret[last] += p[i];
-            }
+            valuelistDecodeSum(&lines[IOLengthInBytes*i], decode, IOLengthInBytes);
+            for (auto v : decode)
+                ret[v] += p[i];
         }
     }
     if (encodetype == L2NodeTypes::MAPP) {
@@ -13,6 +13,12 @@ using namespace std;
 uint32_t valuelistEncode(uint8_t *, vector<uint32_t> &val, bool really); //return encode length in byte.
 
 uint32_t valuelistDecode(uint8_t *, vector<uint32_t> &val, uint32_t maxmem);
+//! \brief decode like valuelistDecode(), but put the running sums of the gaps, i.e., the values of the list, to *val*.
+uint32_t valuelistDecodeSum(const uint8_t *, vector<uint32_t> &val, uint32_t maxmem);
+//! \brief add one to counts[v] for each value v < *limit* of the list, without storing the values. Returns the number of values.
+uint32_t valuelistCount(const uint8_t *, uint32_t maxmem, int *counts, uint32_t limit);
+//! \brief add one to counts[v] for each set bit v < *nbits* of the bitmap *row*, the lowest bit of each byte first.
+void bitmapAccumulate(const uint8_t *row, uint32_t nbits, int *counts);
 
 typedef uint64_t keyType;
 namespace L2NodeTypes {
@@ -22,10 +28,49 @@ static const int MAPP = 4;
 const map<int, string> typestr= { {VALUE_INDEX_SHORT, "ShortValueList"}, {VALUE_INDEX_ENCODED,"EncodedValueList"}, {MAPP,"Bitmap"}};
 };
 
+/*!
+ \brief dedup of the fixed-length rows of an L2 node under construction, by an open-addressing hash table of row ids.
+ \note the distinct rows are kept back to back in an arena, which also gives the keys to rehash when the table grows.
+ */
+class RowDedup {
+    uint32_t rowbytes;
+    vector<uint8_t> arena;
+    vector<uint32_t> ids;    //!< the id of each distinct row, in arena order.
+    vector<uint32_t> slots;  //!< 1 + the arena index of the row, 0 for an empty slot.
+    uint64_t hashRow(const uint8_t *row) const;
+    void grow();
+public:
+    RowDedup(uint32_t _rowbytes) : rowbytes(_rowbytes), slots(1024, 0) {}
+    /*!
+     \brief the id of the row equal to *row*, or *id* if there is none yet, in which case *row* is kept with this id and *fresh* is set.
+     */
+    uint32_t insert(const uint8_t *row, uint32_t id, bool &fresh);
+};
+
 class L2Node {
 public:
     virtual int getType() = 0;
-    virtual bool smartQuery(const keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) = 0;
+    //! \brief decode the entry *index*, as returned by the Othello for a key. Returns false if the entry is a bitmap put in *retmap*.
+    virtual bool queryByIndex(uint64_t index, vector<uint32_t> &ret, vector<uint8_t> &retmap) = 0;
+    bool smartQuery(const keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
+        return queryByIndex(oth->queryInt(*k), ret, retmap);
+    }
+    /*!
+     \brief add one to counts[s] for each sample s < *limit* of the entry *index*, read in place from the stored entry.
+     \note unlike queryByIndex(), nothing is allocated or copied.
+     */
+    virtual void countByIndex(uint64_t index, int *counts, uint32_t limit) = 0;
+    //! \brief the stored bitmap of the entry *index*, with a bit for each sample, or NULL if the entry is not a bitmap.
+    virtual const uint8_t * bitmapByIndex(uint64_t) {
+        return NULL;
+    }
+    void smartCount(const keyType *k, int *counts, uint32_t limit) {
+        countByIndex(oth->queryInt(*k), counts, limit);
+    }
+    //! \brief compute the entry index of *n* keys, to be decoded by queryByIndex().
+    void queryIndexBatch(const keyType *k, size_t n, uint64_t *index) {
+        oth->queryBatch(k, n, index);
+    }
     virtual void add(keyType &k, vector<uint32_t> &) = 0;
     virtual void addMAPP(keyType &k, vector<uint8_t> &mapp) = 0;
     virtual void writeDataToGzipFile() = 0;
@@ -35,6 +80,8 @@ public:
     IOBuf<uint64_t> * keys;
     void constructOth();
     uint32_t entrycnt = 0;
+    uint32_t blockbytes = 0; //!< layout of the Othello, see Othello::blockbytes.
+    uint32_t hashes = 2; //!< 3 to build the Othello as Othello3.
     Othello<uint64_t> *oth = NULL;
     virtual void putInfoToXml(tinyxml2::XMLElement *) = 0;
     virtual uint64_t getvalcnt() = 0;
@@ -47,10 +94,13 @@ public:
 };
 
 class L2ShortValueListNode : public L2Node {
-    vector<uint64_t> uint64list;
+    //! the loaded rows of IOLengthInBytes bytes each, as in the file, followed by 8 bytes for the unaligned loads of row().
+    vector<uint8_t, LargePageAllocator<uint8_t>> rows;
+    uint32_t rowcnt = 0;
+    uint64_t rowmask;
     uint32_t valuecnt, maxnl, mask;
     uint32_t siz = 0;
-    map<uint64_t, uint32_t> valuemap;
+    RowDedup *valuemap = NULL; //!< the rows added so far, over the IOLengthInBytes bytes of each.
     uint32_t IOLengthInBytes;
     void definetypes() {
         mask = (1<<maxnl);
@@ -58,6 +108,13 @@ class L2ShortValueListNode : public L2Node {
         IOLengthInBytes = maxnl*valuecnt /8;
         while (IOLengthInBytes *8 < maxnl*valuecnt)
             IOLengthInBytes++;
+        rowmask = (IOLengthInBytes >= 8) ? ~0ULL : (1ULL << (IOLengthInBytes * 8)) - 1;
+    }
+    //! \brief the packed values of the row *index* < rowcnt, by one unaligned load.
+    inline uint64_t row(uint64_t index) const {
+        uint64_t vl;
+        memcpy(&vl, &rows[index * IOLengthInBytes], sizeof(vl));
+        return vl & rowmask;
     }
 public:
     int getType() override {
@@ -70,8 +127,11 @@ public:
         values = new IOBuf<uint32_t>((fname+".values").c_str());
         definetypes();
     }
-    ~L2ShortValueListNode() {}
-    bool smartQuery(const keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) override;
+    ~L2ShortValueListNode() {
+        delete valuemap;
+    }
+    bool queryByIndex(uint64_t index, vector<uint32_t> &ret, vector<uint8_t> &retmap) override;
+    void countByIndex(uint64_t index, int *counts, uint32_t limit) override;
     void add(keyType &k, vector<uint32_t> &) override;
     void addMAPP(keyType &, vector<uint8_t> &) override {
         throw invalid_argument("can not add bitmap to L2ShortValuelist type");
@@ -86,11 +146,11 @@ public:
 };
 
 class L2EncodedValueListNode : public L2Node {
-    vector<uint8_t> lines;
+    vector<uint8_t, LargePageAllocator<uint8_t>> lines;
     uint32_t siz = 0;
     uint32_t IOLengthInBytes, encodetype;
     uint32_t keycnt  = 0;
-    map<uint64_t, uint32_t> valuemap;
+    RowDedup *valuemap = NULL; //!< the rows added so far, of any length.
 public:
     int getType() override {
         return encodetype;
@@ -103,8 +163,16 @@ public:
         keys = new IOBuf<uint64_t>((fname+".keys").c_str());
         values = new IOBuf<uint32_t>((fname+".values").c_str());
     }
-    ~L2EncodedValueListNode() {}
-    bool smartQuery(const keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) override;
+    ~L2EncodedValueListNode() {
+        delete valuemap;
+    }
+    bool queryByIndex(uint64_t index, vector<uint32_t> &ret, vector<uint8_t> &retmap) override;
+    void countByIndex(uint64_t index, int *counts, uint32_t limit) override;
+    const uint8_t * bitmapByIndex(uint64_t index) override {
+        if (encodetype != L2NodeTypes::MAPP || IOLengthInBytes*index >= lines.size())
+            return NULL;
+        return &lines[IOLengthInBytes*index];
+    }
     void add(keyType &k, vector<uint32_t> &) override;
     void addMAPP(keyType &k, vector<uint8_t> &mapp) override;
     void writeDataToGzipFile() override;
@@ -20,6 +20,7 @@ public:
     }
     //! Release the memory to save some space.
     void finish() {
+        if (fa == NULL) return;
         fa->clear();
         delete fa;
         fa = NULL;
@@ -47,4 +48,40 @@ public:
     bool isroot(int a) {
         return ((*fa)[a]==a);
     }
+    //! \brief getfa() that may run concurrently with getfaConcurrent() and mergeConcurrent() from other threads.
+    uint32_t getfaConcurrent(int i) {
+        int32_t *f = &((*fa)[0]);
+        while (true) {
+            int32_t p = __atomic_load_n(&f[i], __ATOMIC_ACQUIRE);
+            if (p < 0) {
+                int32_t expected = -1;
+                if (__atomic_compare_exchange_n(&f[i], &expected, i, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                    return i;
+                continue;
+            }
+            if (p == i) return i;
+            int32_t gp = __atomic_load_n(&f[p], __ATOMIC_ACQUIRE);
+            //! path halving, only ever points a node to one of its ancestors.
+            if (gp >= 0 && gp != p)
+                __atomic_compare_exchange_n(&f[i], &p, gp, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+            i = p;
+        }
+    }
+    /*!
+     \brief merge the sets of a and b, may run concurrently with other threads.
+     \retval bool return false if a and b are already in the same set.
+     \note the root with the smaller id is always linked under the larger one, so that concurrent merges can not form a loop.
+     */
+    bool mergeConcurrent(int a, int b) {
+        int32_t *f = &((*fa)[0]);
+        while (true) {
+            int32_t ra = getfaConcurrent(a);
+            int32_t rb = getfaConcurrent(b);
+            if (ra == rb) return false;
+            if (ra > rb) swap(ra, rb);
+            int32_t expected = ra;
+            if (__atomic_compare_exchange_n(&f[ra], &expected, rb, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                return true;
+        }
+    }
 };
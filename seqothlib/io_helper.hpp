@@ -16,6 +16,12 @@
 #include <bitset>
 #include <ctime>
 #include <tinyxml2.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
 #include "util.h"
 
 using namespace std;
@@ -980,27 +986,160 @@ public:
 };
 //__attribute__((packed));
 
+/*!
+ \brief the budget of the IOBuf chunks kept in memory, and the thread that writes the other chunks to the files of their IOBufs.
+ \note the chunks are written in the order they are spilled, so the chunks of an IOBuf are in order in its file.
+ */
+class IOBufStager {
+    std::mutex mtx;
+    std::condition_variable cvjob, cvdone;
+    std::queue<std::function<void()>> jobs;
+    uint32_t inflight = 0; //!< jobs queued or running.
+    bool stop = false;
+    std::atomic<uint64_t> staged;
+    std::thread writer;
+    IOBufStager() : staged(0), writer(&IOBufStager::run, this) {}
+    void run() {
+        while (true) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cvjob.wait(lock, [this] { return stop || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                inflight--;
+            }
+            cvdone.notify_all();
+        }
+    }
+public:
+    uint64_t budget = 1ULL << 30; //!< bytes of the chunks of all IOBufs kept in memory.
+    uint32_t maxInflight = 64; //!< chunks waiting to be written, spill() blocks until there are fewer.
+    static IOBufStager & get() {
+        static IOBufStager stager;
+        return stager;
+    }
+    ~IOBufStager() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+        cvjob.notify_all();
+        writer.join();
+    }
+    //! \brief reserve *bytes* of the budget, returns false if they do not fit.
+    bool reserve(uint64_t bytes) {
+        uint64_t cur = staged.load();
+        while (cur + bytes <= budget)
+            if (staged.compare_exchange_weak(cur, cur + bytes))
+                return true;
+        return false;
+    }
+    void unreserve(uint64_t bytes) {
+        staged -= bytes;
+    }
+    //! \brief run *job* on the writer thread, after waiting for the writer if maxInflight jobs are not done yet.
+    void spill(std::function<void()> job) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cvdone.wait(lock, [this] { return inflight < maxInflight; });
+            inflight++;
+            jobs.push(std::move(job));
+        }
+        cvjob.notify_one();
+    }
+    //! \brief wait until *pending* is 0, it is decreased by the spilled jobs.
+    void wait(const std::atomic<uint32_t> &pending) {
+        std::unique_lock<std::mutex> lock(mtx);
+        cvdone.wait(lock, [&pending] { return pending.load() == 0; });
+    }
+};
+
+/*!
+ \brief a buffer that is filled by push_back(), and then read at once through getstart().
+ \note the elements are kept in memory, in chunks of CHUNK elements, while IOBufStager::budget allows it.
+  The other chunks are written to the file *fname* by the IOBufStager thread, so that push_back() does not wait for the disk,
+  unless IOBufStager::maxInflight chunks are already waiting to be written.
+ */
 template <typename keyType>
 class IOBuf {
-    vector<keyType> v;
+    static const size_t CHUNK = 8192;
+    vector<keyType> v; //!< the chunk being filled, or all elements once loaded.
+    vector<vector<keyType>> chunks; //!< the full chunks, those written to the file are empty.
+    uint64_t staged = 0; //!< bytes of the budget reserved by the chunks.
+    std::atomic<uint32_t> pending; //!< chunks not yet written to the file.
     FILE * fout = NULL;
     size_t tot = 0;
     bool load = false;
-    bool done = false;
     char fname[1024];
+    void pushChunk() {
+        uint64_t bytes = v.size() * sizeof(keyType);
+        if (IOBufStager::get().reserve(bytes)) {
+            staged += bytes;
+            chunks.push_back(std::move(v));
+        }
+        else {
+            auto data = std::make_shared<vector<keyType>>(std::move(v));
+            chunks.push_back(vector<keyType>());
+            pending++;
+            IOBufStager::get().spill([this, data] {
+                if (fout == NULL) openfile();
+                if (fout != NULL)
+                    fwrite(&(*data)[0], sizeof(keyType), data->size(), fout);
+                pending--;
+            });
+        }
+        v = vector<keyType>();
+    }
+    void finishwrite() {
+        IOBufStager::get().wait(pending);
+        if (fout != NULL) {
+            fclose(fout);
+            fout = NULL;
+        }
+    }
     void load_from_file() {
-        if (!done)
-            finishwrite();
-        v.resize(tot);
-        FILE *fin = fopen(fname,"rb");
-        size_t max = fread(&v[0], sizeof(keyType), tot, fin);
-        if (max != tot) {
-            fprintf(stderr,"Warning reading %s: read %lu elements , expected %lu elements .\n", fname, max, tot);
+        finishwrite();
+        vector<keyType> all(tot);
+        FILE *fin = NULL;
+        size_t pos = 0;
+        for (auto &c : chunks) {
+            if (c.size()) {
+                memcpy(&all[pos], &c[0], c.size() * sizeof(keyType));
+                pos += c.size();
+                // free the chunk at once, so that the buffer is not held twice.
+                uint64_t bytes = c.size() * sizeof(keyType);
+                vector<keyType>().swap(c);
+                IOBufStager::get().unreserve(bytes);
+                staged -= bytes;
+                continue;
+            }
+            if (fin == NULL)
+                fin = fopen(fname,"rb");
+            size_t max = (fin == NULL) ? 0 : fread(&all[pos], sizeof(keyType), CHUNK, fin);
+            if (max != CHUNK) {
+                fprintf(stderr,"Warning reading %s: read %lu elements , expected %lu elements .\n", fname, max, CHUNK);
+            }
+            pos += CHUNK;
         }
+        if (v.size())
+            memcpy(&all[pos], &v[0], v.size() * sizeof(keyType));
+        v.swap(all);
+        chunks.clear();
+        IOBufStager::get().unreserve(staged);
+        staged = 0;
         load = true;
-        fclose(fin);
-        if ( remove(fname) != 0) {
-            fprintf(stderr,"faile to remove file %s\n", fname);
+        if (fin != NULL) {
+            fclose(fin);
+            if ( remove(fname) != 0) {
+                fprintf(stderr,"faile to remove file %s\n", fname);
+            }
         }
     }
     void openfile() {
@@ -1010,30 +1149,24 @@ class IOBuf {
         }
     }
 public:
-    IOBuf(const char * _fname) {
+    IOBuf(const char * _fname) : pending(0) {
         strcpy(fname,_fname);
         v.clear();
     }
-    void finishwrite() {
-        if (fout == NULL) openfile();
-        if (v.size()) {
-            fwrite(&v[0], v.size(), sizeof(keyType), fout);
-        }
-        fclose(fout);
-        done = true;
-        v.clear();
+    ~IOBuf() {
+        finishwrite();
+        IOBufStager::get().unreserve(staged);
     }
     void push_back(const keyType &t) {
         tot ++;
+        if (v.empty())
+            v.reserve(CHUNK);
         v.push_back(t);
-        if (v.size() == 8192) {
-            if (fout == NULL) openfile();
-            fwrite(&v[0], v.size(), sizeof(keyType), fout);
-            v.clear();
-        }
+        if (v.size() == CHUNK)
+            pushChunk();
     }
     void release() {
-        v.clear();
+        vector<keyType>().swap(v);
     }
     size_t size() {
         return tot;
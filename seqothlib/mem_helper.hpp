@@ -0,0 +1,270 @@
+// This file is a part of SeqOthello. Please refer to LICENSE.TXT for the LICENSE
+#pragma once
+/*!
+ * \file mem_helper.hpp
+ * Contains the storage used for the large arrays of SeqOthello.
+ */
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <map>
+#include <mutex>
+#include <new>
+
+using namespace std;
+
+//! \brief arrays stored in a mappable file start at a multiple of this offset.
+static const uint64_t MAPPABLE_PAGE = 4096;
+
+inline uint64_t alignToMappablePage(uint64_t offset) {
+    return (offset + MAPPABLE_PAGE - 1) / MAPPABLE_PAGE * MAPPABLE_PAGE;
+}
+
+//! \brief how large arrays are allocated, see hugePageMode().
+enum HugePageMode {
+    HUGEPAGE_NONE = 0,          //!< the default heap.
+    HUGEPAGE_TRANSPARENT = 1,   //!< pages advised to be transparent huge pages, by madvise(MADV_HUGEPAGE).
+    HUGEPAGE_2M = 2,            //!< explicit 2 MiB huge pages, by MAP_HUGETLB, falling back to HUGEPAGE_TRANSPARENT.
+    HUGEPAGE_1G = 3,            //!< explicit 1 GiB huge pages for arrays of about 1 GiB or more, HUGEPAGE_2M for the others.
+};
+//! \brief arrays of at least this many bytes are allocated as set by hugePageMode().
+static const uint64_t LARGE_ARRAY_BYTES = 1ULL << 21;
+
+//! \brief the allocation of the large arrays loaded from now on, HUGEPAGE_NONE by default.
+inline int & hugePageMode() {
+    static int mode = HUGEPAGE_NONE;
+    return mode;
+}
+
+/*!
+ \brief map *bytes* zeroed bytes as set by hugePageMode(), and set *len* to the length to unmap.
+ \retval NULL if the memory can not be mapped.
+ */
+inline void * allocLargePages(size_t bytes, size_t &len) {
+    int mode = hugePageMode();
+#ifdef MAP_HUGETLB
+    if (mode == HUGEPAGE_2M || mode == HUGEPAGE_1G) {
+        const int MAP_HUGE_SHIFT_ = 26;
+        // 1 GiB pages only if rounding up to them wastes at most 1/8 of the array, 2 MiB pages otherwise, or if they run out.
+        size_t hl1g = (bytes + (1ULL << 30) - 1) >> 30 << 30;
+        int first = (mode == HUGEPAGE_1G && hl1g - bytes <= bytes / 8) ? 30 : 21;
+        for (int shift = first; shift >= 21; shift -= 9) {
+            size_t hl = (bytes + (1ULL << shift) - 1) >> shift << shift;
+            void *p = mmap(NULL, hl, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT_), -1, 0);
+            if (p != MAP_FAILED) {
+                len = hl;
+                return p;
+            }
+        }
+    }
+#endif
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if (mode != HUGEPAGE_NONE)
+        madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    len = bytes;
+    return p;
+}
+
+/*!
+ \brief a std allocator that allocates the large arrays with allocLargePages(), and the others on the heap.
+ \note the large allocations are recorded, with their lengths, so that they are unmapped even if hugePageMode() changes.
+ */
+template <typename T>
+struct LargePageAllocator {
+    typedef T value_type;
+    LargePageAllocator() {}
+    template <typename U>
+    LargePageAllocator(const LargePageAllocator<U> &) {}
+    static std::map<void *, size_t> & mapped() {
+        static std::map<void *, size_t> m;
+        return m;
+    }
+    static std::mutex & mappedLock() {
+        static std::mutex mu;
+        return mu;
+    }
+    T * allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (hugePageMode() == HUGEPAGE_NONE || bytes < LARGE_ARRAY_BYTES)
+            return (T *) ::operator new(bytes);
+        size_t len = 0;
+        void *p = allocLargePages(bytes, len);
+        if (p == NULL)
+            throw std::bad_alloc();
+        std::lock_guard<std::mutex> lock(mappedLock());
+        mapped()[p] = len;
+        return (T *) p;
+    }
+    void deallocate(T *p, size_t n) {
+        if (n * sizeof(T) >= LARGE_ARRAY_BYTES) {
+            std::lock_guard<std::mutex> lock(mappedLock());
+            auto it = mapped().find((void *) p);
+            if (it != mapped().end()) {
+                munmap(p, it->second);
+                mapped().erase(it);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+};
+template <typename T, typename U>
+bool operator == (const LargePageAllocator<T> &, const LargePageAllocator<U> &) {
+    return true;
+}
+template <typename T, typename U>
+bool operator != (const LargePageAllocator<T> &, const LargePageAllocator<U> &) {
+    return false;
+}
+
+/*!
+ * \brief A fixed-length array of T. The memory is either allocated on the heap, mapped read-only from a file, or allocated on a NUMA node.
+ * \note A mapped array shares the page cache with other processes mapping the same file, and must not be modified.
+ */
+template <typename T>
+class MemArray {
+    T *p = NULL;
+    size_t n = 0;
+    vector<T> heap;
+    void *mapaddr = NULL;
+    size_t maplen = 0;
+    bool anonymous = false; //!< the mapping is memory allocated by allocOnNode() or allocLargePages(), not a file.
+public:
+    MemArray() {}
+    MemArray(const MemArray &) = delete;
+    MemArray & operator = (const MemArray &) = delete;
+    ~MemArray() {
+        clear();
+    }
+    //! \brief release the array, either unmap the file or free the heap space.
+    void clear() {
+        if (mapaddr != NULL)
+            munmap(mapaddr, maplen);
+        mapaddr = NULL;
+        maplen = 0;
+        anonymous = false;
+        heap.clear();
+        heap.shrink_to_fit();
+        p = NULL;
+        n = 0;
+    }
+    //! \brief allocate *_n* elements, all set to zero, on the heap, or as set by hugePageMode() for a large array.
+    void resize(size_t _n) {
+        clear();
+        uint64_t bytes = _n * sizeof(T);
+        if (hugePageMode() != HUGEPAGE_NONE && bytes >= LARGE_ARRAY_BYTES) {
+            size_t len = 0;
+            void *addr = allocLargePages(bytes, len);
+            if (addr != NULL) {
+                mapaddr = addr;
+                maplen = len;
+                anonymous = true;
+                p = (T *) addr;
+                n = _n;
+                return;
+            }
+        }
+        heap.resize(_n);
+        p = heap.data();
+        n = _n;
+    }
+    /*!
+     \brief map *_n* elements stored at *offset* of file *fname*.
+     \retval bool return false if the file is too short or can not be mapped.
+     */
+    bool mapFile(const char *fname, uint64_t offset, size_t _n) {
+        clear();
+        if (_n == 0) return true;
+        int fd = open(fname, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "failed to open file %s to map: %s\n", fname, strerror(errno));
+            return false;
+        }
+        struct stat st;
+        uint64_t bytes = _n * sizeof(T);
+        if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < offset + bytes) {
+            fprintf(stderr, "file %s is too short to map %lu bytes at %lu\n", fname, bytes, offset);
+            close(fd);
+            return false;
+        }
+        //! the system page may be larger than MAPPABLE_PAGE, map from the enclosing page.
+        uint64_t sys = sysconf(_SC_PAGESIZE);
+        uint64_t delta = offset % sys;
+        maplen = bytes + delta;
+        mapaddr = mmap(NULL, maplen, PROT_READ, MAP_SHARED, fd, offset - delta);
+        close(fd);
+        if (mapaddr == MAP_FAILED) {
+            fprintf(stderr, "failed to map file %s: %s\n", fname, strerror(errno));
+            mapaddr = NULL;
+            maplen = 0;
+            return false;
+        }
+        p = (T *) ((uint8_t *) mapaddr + delta);
+        n = _n;
+        return true;
+    }
+    /*!
+     \brief allocate *_n* elements, all set to zero, preferably on the memory of NUMA node *node*.
+     \note the placement is a hint to the kernel, set by mbind(MPOL_PREFERRED). It is ignored if NUMA is not supported.
+     */
+    bool allocOnNode(size_t _n, int node) {
+        clear();
+        if (_n == 0) return true;
+        uint64_t bytes = _n * sizeof(T);
+        void *addr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            resize(_n);
+            return false;
+        }
+        const int MPOL_PREFERRED_ = 1;
+        unsigned long mask[16];
+        memset(mask, 0, sizeof(mask));
+        if (node >= 0 && node < (int) sizeof(mask) * 8)
+            mask[node / 64] |= 1UL << (node % 64);
+        syscall(SYS_mbind, addr, bytes, MPOL_PREFERRED_, mask, sizeof(mask) * 8, 0);
+#ifdef MADV_HUGEPAGE
+        if (hugePageMode() != HUGEPAGE_NONE)
+            madvise(addr, bytes, MADV_HUGEPAGE);
+#endif
+        mapaddr = addr;
+        maplen = bytes;
+        anonymous = true;
+        p = (T *) addr;
+        n = _n;
+        return true;
+    }
+    //! \brief the memory is allocated by allocOnNode(), or by allocLargePages().
+    bool isAnonymous() const {
+        return anonymous;
+    }
+    //! \brief true if the array is mapped from a file.
+    bool isMapped() const {
+        return mapaddr != NULL && !anonymous;
+    }
+    size_t size() const {
+        return n;
+    }
+    T * data() {
+        return p;
+    }
+    const T * data() const {
+        return p;
+    }
+    inline T & operator[] (size_t i) {
+        return p[i];
+    }
+    inline const T & operator[] (size_t i) const {
+        return p[i];
+    }
+};
@@ -31,6 +31,17 @@ public:
     uint32_t L2IDShift;
     uint32_t sampleCount;
     uint32_t L1Splitbit;
+    uint32_t l1BlockBytes = 0; //!< Othello layout of the L1 parts built by constructFromReader(), see Othello::blockbytes.
+    uint32_t l2BlockBytes = 0; //!< Othello layout of the L2 nodes built by constructFromReader().
+    uint32_t l1Hashes = 2; //!< 3 to build the L1 parts as Othello3.
+    uint32_t l2Hashes = 2; //!< 3 to build the L2 nodes as Othello3.
+    uint64_t l1BuildMemoryBytes = 0; //!< see L1Node::buildMemoryBytes.
+    bool l1Balanced = false; //!< see L1Node::balanced.
+    vector<uint64_t> l1Boundaries; //!< the boundaries of the L1 parts, read from the xml, see L1Node::setBoundaries().
+    string l1SharedCacheDir; //!< see L1Node::sharedCacheDir.
+    uint64_t l1SharedCacheBytes = 0; //!< see L1Node::sharedCacheBytes.
+    bool l1NumaReplicas = false; //!< loadAll() replicates the L1 node on each NUMA node, see L1Node::replicate().
+    int loadIOThreads = 0; //!< number of files, L1 parts or L2 nodes, loaded concurrently by loadAll(). 0 to use its nloadThreads.
     SeqOthello() {}
     static const Version version;
     static const Version min_supported_version;
@@ -69,9 +80,15 @@ private:
     thread * L1LoadThread;
     vector<thread *> L2LoadThreads;
 public:
+    //! \brief create the L1 node to be loaded from the map.
+    L1Node * newL1Node(uint32_t kmerLength) {
+        L1Node *p = new L1Node();
+        p->setsplitbit(kmerLength,L1Splitbit);
+        p->setBoundaries(l1Boundaries);
+        return p;
+    }
     void loadL1(uint32_t kmerLength) {
-        l1Node = new L1Node();
-        l1Node->setsplitbit(kmerLength,L1Splitbit);
+        l1Node = newL1Node(kmerLength);
         l1Node->loadFromFile(folder + L1NODE_PREFIX);
         /*
         printf("Starting to load L1 from disk\n");
@@ -102,6 +119,7 @@ private:
 public:
     void releaseL1() {
         delete l1Node;
+        l1Node = NULL;
     }
     void releaseL2Node(int id) {
         vNodes[id].reset();
@@ -137,6 +155,13 @@ public:
         pSeq->QueryIntAttribute("KmerLength", (int*) &kmerLength);
         pSeq->QueryIntAttribute("L2IDShift", (int*) &L2IDShift);
         pSeq->QueryIntAttribute("L1SplitBit", (int*) &L1Splitbit);
+        auto pL1Node = pSeq->FirstChildElement("L1Node");
+        if (pL1Node != NULL && pL1Node->Attribute("Boundaries") != NULL) {
+            stringstream ss(pL1Node->Attribute("Boundaries"));
+            uint64_t b;
+            while (ss >> hex >> b)
+                l1Boundaries.push_back(b);
+        }
         const char * retchar = pSeq->Attribute ("SeqOthelloVersion");
         if (retchar == NULL) {
             throw std::invalid_argument("SeqOthelloVersion missing");
@@ -165,7 +190,15 @@ public:
     }
 
     bool smartQuery(keyType *k, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
-        uint64_t othquery = l1Node->queryInt(*k);
+        return queryWithL1Value(k, l1Node->queryInt(*k), ret, retmap);
+    }
+
+    //! \brief query the L1 values of *n* keys, to be passed to queryWithL1Value().
+    void queryL1Batch(const keyType *k, size_t n, uint64_t *out) {
+        l1Node->queryBatch(k, n, out);
+    }
+
+    bool queryWithL1Value(const keyType *k, uint64_t othquery, vector<uint32_t> &ret, vector<uint8_t> &retmap) {
         // value : 1..high+1 :  ID = tau - 1
         // high+2 .. : stored in vNode[tau - high - 1]...
         ret.clear();
@@ -179,6 +212,19 @@ public:
         return vNodes[othquery - L2IDShift]->smartQuery(k, ret, retmap);
     }
 
+    //! \brief add one to counts[s] for each sample s < *limit* of key *k* with L1 value *othquery*, without allocation.
+    void countWithL1Value(const keyType *k, uint64_t othquery, int *counts, uint32_t limit) {
+        if (othquery ==0 ) return;
+        if (othquery < L2IDShift) {
+            if (othquery-1 < limit)
+                counts[othquery-1]++;
+            return;
+        }
+        if (othquery - L2IDShift >= vNodes.size()) return;
+        if (!vNodes[othquery-L2IDShift] ) return;
+        vNodes[othquery - L2IDShift]->smartCount(k, counts, limit);
+    }
+
     void writeSeqOthelloInfo(string folder, function<void(tinyxml2::XMLElement *)> func, vector<uint64_t> &histogram) {
         tinyxml2::XMLDocument xml;
         auto pRoot = xml.NewElement("Root");
@@ -226,6 +272,11 @@ public:
         ss >> fname2;
         return fname2;
     }
+    void addL2Node(std::shared_ptr<L2Node> p) {
+        p->blockbytes = l2BlockBytes;
+        p->hashes = l2Hashes;
+        vNodes.push_back(p);
+    }
     set<int> constructedL2;
     void constructL2Node(int id) {
         if (constructedL2.count(id))
@@ -254,16 +305,45 @@ public:
         printf("Empty L2 Node %d.\n", id);
         vNodes[id].reset();
     }
+    /*!
+     \brief load the L1 parts and the L2 nodes from disk, loadIOThreads files at a time.
+     \note the L1 parts and the L2 nodes share one pool, the L1 parts are started first, and the L2 nodes are loaded while the last L1 parts are still loading.
+     */
     void loadAll(int nloadThreads) {
-        loadL1(kmerLength);
-        startloadL2(nloadThreads);
-        waitloadL2();
+        int nio = loadIOThreads > 0 ? loadIOThreads : nloadThreads;
+        if (nio < 1) nio = 1;
+        printf("%s: Loading SeqOthello from disk with %d threads\n", get_thid().c_str(), nio);
+        ThreadPool pool(nio, 1024);
+        std::vector<std::future<int>> results;
+        l1Node = newL1Node(kmerLength);
+        l1Node->loadFromFile(folder + L1NODE_PREFIX, pool, results, 0);
+        for (uint32_t i = 0; i < vNodes.size(); i++) {
+            auto lambda = [this, i]() {
+                loadL2Node(i);
+                return 0;
+            };
+            results.emplace_back(pool.enqueue(1, lambda));
+        }
+        for (auto && result: results)
+            result.get();
+        printf("Load L2 finished \n");
+        if (l1NumaReplicas) {
+            vector<int> nodes = numaNodesWithCPUs();
+            if (nodes.size() > 1)
+                l1Node->replicate(nodes);
+            else
+                printf("One NUMA node, the L1 node is not replicated.\n");
+        }
     }
     void constructFromReader(KmerGroupComposer<keyType> *reader, string filename, uint32_t threadsLimit, vector<uint32_t> enclGrpmap, uint64_t estimatedKmerCount) {
         kmerLength = reader->getKmerLength();
         folder = filename;
         keyType k;
         l1Node = new L1Node(estimatedKmerCount, kmerLength, filename+"tmp");
+        l1Node->blockbytes = l1BlockBytes;
+        l1Node->hashes = l1Hashes;
+        l1Node->buildMemoryBytes = l1BuildMemoryBytes;
+        l1Node->balanced = l1Balanced;
         printf("We will use at most %d threads to construct.\n", threadsLimit);
         printf("Use encode length to split L2 nodes at: ");
         for (uint32_t i = 1; i < enclGrpmap.size(); i++) {
@@ -293,18 +373,18 @@ public:
 
 
         for (unsigned int i = 2; i<=limitsingle; i++) {
-            vNodes.push_back(std::make_shared<L2ShortValueListNode>(i, maxnl, toL2Name(vNodes.size())));
+            addL2Node(std::make_shared<L2ShortValueListNode>(i, maxnl, toL2Name(vNodes.size())));
             valshortIDmap[i] = vNodes.size()-1;
         }
         for (unsigned int i = 0 ; i < enclGrpIDmap.size(); i++) {
-            vNodes.push_back(std::make_shared<L2EncodedValueListNode>(enclGrplen[i], L2NodeTypes::VALUE_INDEX_ENCODED,toL2Name(vNodes.size())));
+            addL2Node(std::make_shared<L2EncodedValueListNode>(enclGrplen[i], L2NodeTypes::VALUE_INDEX_ENCODED,toL2Name(vNodes.size())));
             enclGrpIDmap[i] = vNodes.size()-1;
         }
 
         uint32_t MAPPlength = high/8;
         if (high &7) MAPPlength++;
 
-        vNodes.push_back(std::make_shared<L2EncodedValueListNode>(MAPPlength,L2NodeTypes::MAPP, toL2Name(vNodes.size())));
+        addL2Node(std::make_shared<L2EncodedValueListNode>(MAPPlength,L2NodeTypes::MAPP, toL2Name(vNodes.size())));
         uint32_t MAPPID = vNodes.size()-1;
         uint32_t MAPPcnt = 0;
 
@@ -329,7 +409,7 @@ public:
                 } else {
                     valshortcnt[valcnt] = 0;
                     startBuildOneL2(valshortIDmap[valcnt]);
-                    vNodes.push_back(std::make_shared<L2ShortValueListNode>(valcnt, maxnl, toL2Name(vNodes.size())));
+                    addL2Node(std::make_shared<L2ShortValueListNode>(valcnt, maxnl, toL2Name(vNodes.size())));
                     L2limit+=(vNodes.size()*L2diff);
                     if (((512 - vNodes.size()) & (511-vNodes.size()))== 0) L2diff*=2;
                     valshortIDmap[valcnt] = vNodes.size() - 1;
@@ -356,7 +436,7 @@ public:
                 } else {
                     enclGrpcnt[grpid] = 0;
                     startBuildOneL2(enclGrpIDmap[grpid]);
-                    vNodes.push_back(std::make_shared<L2EncodedValueListNode>(enclGrplen[grpid], L2NodeTypes::VALUE_INDEX_ENCODED, toL2Name(vNodes.size())));
+                    addL2Node(std::make_shared<L2EncodedValueListNode>(enclGrplen[grpid], L2NodeTypes::VALUE_INDEX_ENCODED, toL2Name(vNodes.size())));
                     L2limit+=(vNodes.size()*L2diff);
                     if (((512 - vNodes.size()) & (511-vNodes.size()))== 0) L2diff*=2;
                     enclGrpIDmap[grpid] = vNodes.size() - 1;
@@ -369,7 +449,7 @@ public:
             if (MAPPcnt * MAPPlength > L2limit)  {
                 MAPPcnt = 0;
                 startBuildOneL2(MAPPID);
-                vNodes.push_back(std::make_shared<L2EncodedValueListNode>(MAPPlength, L2NodeTypes::MAPP, toL2Name(vNodes.size())));
+                addL2Node(std::make_shared<L2EncodedValueListNode>(MAPPlength, L2NodeTypes::MAPP, toL2Name(vNodes.size())));
                 L2limit+=(vNodes.size()*L2diff);
                 if (((512 - vNodes.size()) & (511-vNodes.size()))== 0) L2diff*=2;
                 MAPPID = vNodes.size() - 1;
@@ -479,15 +559,18 @@ public:
         return encodeLengthToL1ID;
     }
     vector<vector<uint16_t>> QueryL1ByPartition(vector<vector<uint64_t>> &kmers, int nThreads) {
-        l1Node = new L1Node();
-        l1Node->setsplitbit(kmerLength,L1Splitbit);
-        l1Node->setfname(folder + L1NODE_PREFIX);
+        //! the L1 node is kept for the next calls.
+        if (l1Node == NULL) {
+            l1Node = newL1Node(kmerLength);
+            l1Node->setfname(folder + L1NODE_PREFIX);
+            l1Node->sharedCacheDir = l1SharedCacheDir;
+            l1Node->sharedCacheBytes = l1SharedCacheBytes;
+        }
         //loadL1(kmerLength);
         vector<vector<uint16_t>> ans;
         for (auto &vk:kmers)
             ans.push_back(vector<uint16_t>(vk.size()));
-        for (int grp = 0; grp < (1<<L1Splitbit); grp++)
-            l1Node->queryPartAndPutToVV(ans,kmers,grp,nThreads);
+        l1Node->queryByPartAndPutToVV(ans,kmers,nThreads);
         return ans;
     }
     void printrates() {
@@ -521,5 +604,5 @@ public:
     }
 };
 
-const Version SeqOthello::version = Version("1.0.0");
+const Version SeqOthello::version = Version("1.1.0");
 const Version SeqOthello::min_supported_version = Version("1.0.0");
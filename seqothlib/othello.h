@@ -11,9 +11,20 @@
 #include <queue>
 #include <cstring>
 #include <list>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
 #include <io_helper.hpp>
 #include "disjointset.h"
+#include "mem_helper.hpp"
 #include <zlib.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include <map>
 
@@ -21,6 +32,75 @@
 
 using namespace std;
 
+/*!
+ * \brief Get the cell *loc* of an Othello array with cells of LL bits, LL <= 64.
+ * \note No branches: the second load reads the word holding the last bit of the cell, which is the first word if the cell does not cross the barrier.
+ * Then its bits shifted in land above the cell and are masked off.
+ */
+template <uint32_t LL>
+inline uint64_t othelloCellL(const uint64_t *mem, uint32_t loc) {
+    const uint64_t mask = (LL == 64) ? (~0ULL) : ((1ULL << LL) - 1);
+    uint64_t st = ((uint64_t) loc) * LL;
+    uint32_t mx = st & 0x3F;
+    if ((LL & (LL - 1)) == 0)
+        return (mem[st >> 6] >> mx) & mask;
+    return ((mem[st >> 6] >> mx) | ((mem[(st + LL - 1) >> 6] << 1) << (63 - mx))) & mask;
+}
+
+//! \brief othelloCellL() for a width L only known at run time.
+inline uint64_t othelloCell(const uint64_t *mem, uint32_t L, uint32_t loc) {
+    const uint64_t mask = (L == 64) ? (~0ULL) : ((1ULL << L) - 1);
+    uint64_t st = ((uint64_t) loc) * L;
+    uint32_t mx = st & 0x3F;
+    return ((mem[st >> 6] >> mx) | ((mem[(st + L - 1) >> 6] << 1) << (63 - mx))) & mask;
+}
+
+//! \brief set the cell *loc* of an Othello array with cells of L bits to *value*, which must fit in L bits.
+inline void othelloSetCell(uint64_t *mem, uint32_t L, uint32_t loc, uint64_t value) {
+    const uint64_t mask = (L == 64) ? (~0ULL) : ((1ULL << L) - 1);
+    uint64_t st = ((uint64_t) loc) * L;
+    uint32_t mx = st & 0x3F;
+    mem[st >> 6] = (mem[st >> 6] & ~(mask << mx)) | (value << mx);
+    if (mx + L > 64)
+        mem[(st >> 6) + 1] = (mem[(st >> 6) + 1] & ~(mask >> (64 - mx))) | (value >> (64 - mx));
+}
+
+//! \brief the query values of *n* keys, whose hash values are ha[] and hb[], for an Othello with cells of LL bits.
+template <uint32_t LL>
+void othelloGatherL(const uint64_t *mem, uint32_t, const uint32_t *ha, const uint32_t *hb, size_t n, uint64_t *out) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = othelloCellL<LL>(mem, ha[i]) ^ othelloCellL<LL>(mem, hb[i]);
+}
+
+inline void othelloGather(const uint64_t *mem, uint32_t L, const uint32_t *ha, const uint32_t *hb, size_t n, uint64_t *out) {
+    for (size_t i = 0; i < n; i++)
+        out[i] = othelloCell(mem, L, ha[i]) ^ othelloCell(mem, L, hb[i]);
+}
+
+typedef void (*OthelloGatherFn)(const uint64_t *, uint32_t, const uint32_t *, const uint32_t *, size_t, uint64_t *);
+
+/*!
+ * \brief selects othelloGatherL<L>() for L in [LO..HI], and othelloGather() for other L.
+ */
+template <uint32_t LO, uint32_t HI>
+struct OthelloGatherTable {
+    static OthelloGatherFn get(uint32_t L) {
+        return (L == LO) ? &othelloGatherL<LO> : OthelloGatherTable<LO + 1, HI>::get(L);
+    }
+};
+
+template <uint32_t HI>
+struct OthelloGatherTable<HI, HI> {
+    static OthelloGatherFn get(uint32_t L) {
+        return (L == HI) ? &othelloGatherL<HI> : &othelloGather;
+    }
+};
+
+//! \brief The widths used by L1 parts, down to 1 bit, see L1Node::partValueWidth(), and by L2 nodes of practical sizes are specialized.
+inline OthelloGatherFn selectOthelloGather(uint32_t L) {
+    return OthelloGatherTable<1, 24>::get(L);
+}
+
 /*!
  * \brief Describes the data structure *l-Othello*. It classifies keys of *keyType* into *2^L* classes.
  * \note Query a key of keyType always return uint64_t, however, only the lowest L bits are meaningful. \n
@@ -33,6 +113,7 @@ class Othello
     class Hasher32 {
     public:
         uint32_t mask; //!< a bitmask for the return value. return value must be within [0..mask]
+        uint32_t range = 0; //!< if nonzero, the return value is reduced to [0..range-1] by multiply-shift, and mask is not used.
         uint32_t s;   //!< hash seed.
     private:
         std::hash<keyType> fallback;
@@ -41,9 +122,19 @@ class Othello
         //! set bitmask and seed
         void setMaskSeed(uint32_t _mask, uint32_t _seed) {
             mask = _mask;
+            range = 0;
             s = _seed;
             hashshr = s & 7;
         }
+        //! set the range [0..range-1] of any length, and seed
+        void setRangeSeed(uint32_t _range, uint32_t _seed) {
+            setMaskSeed(~0U, _seed);
+            range = _range;
+        }
+        //! reduce a 32-bit hash value to the range, or apply the bitmask.
+        inline uint32_t reduce(uint32_t h) const {
+            return range ? (uint32_t) (((uint64_t) h * range) >> 32) : (mask & h);
+        }
         template <class T = keyType>
         typename std::enable_if<std::is_integral<T>::value, uint32_t>::type
         operator()(const keyType& k0) const {
@@ -82,19 +173,84 @@ class Othello
 //    crc1 ^= (crc1 >> (HASHLENGTH ^ (7&s1)));
             crc1 ^= (crc1 >> (hashshr));
             if (sizeof(keyType)==4)
-                return mask & (crc1 ^ ((uint32_t) *k));
+                return reduce(crc1 ^ ((uint32_t) *k));
             else
-                return mask & (crc1 ^ (*k >> 32) ^ ((uint32_t) *k));
+                return reduce(crc1 ^ (*k >> 32) ^ ((uint32_t) *k));
 #else
 #pragma message("Build without SSE4.2 support ")
-            return mask & fallback(k0);
+            return reduce(fallback(k0));
 #endif
         }
 
         template <class T = keyType>
         typename std::enable_if<!std::is_integral<T>::value, uint32_t>::type
         operator()(const keyType& k0) const {
-            return mask & fallback(k0^s ^ (s <<(8+hashshr)));
+            return reduce(fallback(k0^s ^ (s <<(8+hashshr))));
+        }
+
+        /*!
+         \brief compute the hash values of *n* 64-bit keys, out[i] = (*this)(k[i]).
+         \note The CRC32 of consecutive keys are independent, so they are issued back to back and pipelined by the CPU.
+          The shift/xor fix-ups are then applied to 8 keys at a time with AVX2. Results are identical to operator().
+         */
+        template <class T = keyType>
+        typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 8, void>::type
+        hashBatch(const keyType *k, size_t n, uint32_t *out) const {
+#if defined(__SSE4_2__)
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4) {
+                uint32_t c0 = _mm_crc32_u64(~0U, k[i] + s);
+                uint32_t c1 = _mm_crc32_u64(~0U, k[i+1] + s);
+                uint32_t c2 = _mm_crc32_u64(~0U, k[i+2] + s);
+                uint32_t c3 = _mm_crc32_u64(~0U, k[i+3] + s);
+                out[i] = _mm_crc32_u32(c0, s);
+                out[i+1] = _mm_crc32_u32(c1, s);
+                out[i+2] = _mm_crc32_u32(c2, s);
+                out[i+3] = _mm_crc32_u32(c3, s);
+            }
+            for (; i < n; i++)
+                out[i] = _mm_crc32_u32(_mm_crc32_u64(~0U, k[i] + s), s);
+            i = 0;
+#if defined(__AVX2__)
+            const __m256i vmask = _mm256_set1_epi32(mask);
+            const __m256i vrange = _mm256_set1_epi32(range);
+            const __m128i vshr = _mm_cvtsi32_si128(hashshr);
+            const __m256i lo32 = _mm256_setr_epi32(0,2,4,6,0,2,4,6);
+            for (; i + 8 <= n; i += 8) {
+                __m256i c = _mm256_loadu_si256((const __m256i *) (out + i));
+                c = _mm256_xor_si256(c, _mm256_srl_epi32(c, vshr));
+                __m256i k0 = _mm256_loadu_si256((const __m256i *) (k + i));
+                __m256i k1 = _mm256_loadu_si256((const __m256i *) (k + i + 4));
+                k0 = _mm256_permutevar8x32_epi32(_mm256_xor_si256(k0, _mm256_srli_epi64(k0, 32)), lo32);
+                k1 = _mm256_permutevar8x32_epi32(_mm256_xor_si256(k1, _mm256_srli_epi64(k1, 32)), lo32);
+                c = _mm256_xor_si256(c, _mm256_blend_epi32(k0, k1, 0xF0));
+                if (range) {
+                    //! multiply-shift of the even and odd lanes, the odd products already have their high halves in place.
+                    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(c, vrange), 32);
+                    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(c, 32), vrange);
+                    c = _mm256_blend_epi32(even, odd, 0xAA);
+                }
+                else
+                    c = _mm256_and_si256(c, vmask);
+                _mm256_storeu_si256((__m256i *) (out + i), c);
+            }
+#endif
+            for (; i < n; i++) {
+                uint32_t crc1 = out[i];
+                crc1 ^= (crc1 >> hashshr);
+                out[i] = reduce(crc1 ^ (k[i] >> 32) ^ ((uint32_t) k[i]));
+            }
+#else
+            for (size_t i = 0; i < n; i++)
+                out[i] = (*this)(k[i]);
+#endif
+        }
+
+        template <class T = keyType>
+        typename std::enable_if<!(std::is_integral<T>::value && sizeof(T) == 8), void>::type
+        hashBatch(const keyType *k, size_t n, uint32_t *out) const {
+            for (size_t i = 0; i < n; i++)
+                out[i] = (*this)(k[i]);
         }
 
     };
@@ -102,7 +258,7 @@ class Othello
     typedef uint64_t valueType;
 #define MAX_REHASH 20 //!< Maximum number of rehash tries before report an error. If this limit is reached, Othello build fails. 
 public:
-    vector<valueType> mem; //!< actual memory space for arrayA and arrayB.
+    MemArray<valueType> mem; //!< actual memory space for arrayA and arrayB.
     uint32_t L; //!< the length of return value.
 //    uint32_t LMASK;  return value must be within [0..2^L-1], i.e., LMASK==((1<<L)-1);
 #define LMASK ((L==64)?(~0ULL):((1ULL<<L)-1))
@@ -110,6 +266,39 @@ public:
     uint32_t mb; //!< length of arrayB
     Hasher32 Ha; //<! hash function Ha
     Hasher32 Hb; //<! hash function Hb
+    /*!
+     \brief length of arrayC, 0 unless the three-hash layout is used, see Othello3.
+      In this layout, ma, mb and mc are equal, and the query value is the xor of the cells at Ha, Hb and Hc.
+     */
+    uint32_t mc = 0;
+    Hasher32 Hc; //<! hash function Hc, only used by the three-hash layout.
+    OthelloGatherFn gather = &othelloGather; //!< query kernel for the width L, see selectOthelloGather().
+    /*!
+     \brief 0 for the classic layout. Otherwise the array is split into *nblocks* blocks of *blockbytes* bytes,
+      and both cells of a key are in the same block, see queryBlocked(). ma and mb are 0 in this layout.
+     */
+    uint32_t blockbytes = 0;
+    uint32_t nblocks = 0; //!< number of blocks in the blocked layout.
+    uint32_t blockA = 0; //!< number of cells of arrayA in a block.
+    uint32_t blockB = 0; //!< number of cells of arrayB in a block.
+    static const uint32_t BLOCK_SEED_BITS = 8; //!< the highest bits of a block select the hash of the cells in this block.
+    //! \brief number of uint64_t words needed to store arrayA and arrayB.
+    uint64_t memSize() const {
+        if (blockbytes)
+            return ((uint64_t) nblocks) * (blockbytes / 8);
+        return (((uint64_t) ma + mb + mc) * L + 63) / 64;
+    }
+    //! \brief use the blocked layout with *_nblocks* blocks of *_blockbytes* bytes.
+    void setBlockLayout(uint32_t _blockbytes, uint32_t _nblocks) {
+        if (_blockbytes % 8 || _blockbytes * 8 < 2 * L + BLOCK_SEED_BITS)
+            throw std::invalid_argument("invalid block size for Othello");
+        blockbytes = _blockbytes;
+        nblocks = _nblocks;
+        uint32_t cells = (blockbytes * 8 - BLOCK_SEED_BITS) / L;
+        blockA = (cells + 1) / 2;
+        blockB = cells / 2;
+        ma = mb = 0;
+    }
     bool build = false; //!< true if Othello is successfully built.
     uint32_t trycount = 0; //!< number of rehash before a valid hash pair is found.
     DisjointSet disj; //!< Disjoint Set data structure that helps to test the acyclicity.
@@ -117,8 +306,52 @@ public:
 #define FILLCNTLEN (sizeof(uint32_t)*8)
     uint32_t allowed_conflicts; //!< The number of keys that can be skipped during construction.
     vector<keyType> removedKeys; //!< The list of removed keys.
+    /*!
+     \brief the removed keys, sorted, and their values in overflowValues. They are found on query through overflowSlots, see queryOverflow().
+     \note Empty if the values of the keys are not given, e.g., when the Othello classifies the keys.
+     */
+    vector<keyType> overflowKeys;
+    vector<valueType> overflowValues;
+    vector<uint32_t> overflowSlots; //!< open addressing index of overflowKeys, a slot is 0 or 1 + the position of a key.
+    uint32_t overflowShift = 64; //!< the slot of a key is its multiplicative hash shifted right by this.
+    //! \brief build overflowSlots, with at least twice as many slots as the keys.
+    void indexOverflow() {
+        overflowSlots.clear();
+        if (overflowKeys.empty()) return;
+        uint32_t bits = 1;
+        while ((1ULL << bits) < 2 * overflowKeys.size()) bits++;
+        overflowShift = 64 - bits;
+        overflowSlots.assign(1ULL << bits, 0);
+        for (uint32_t i = 0; i < overflowKeys.size(); i++) {
+            uint64_t x = overflowSlot(overflowKeys[i]);
+            while (overflowSlots[x]) x = (x + 1) & (overflowSlots.size() - 1);
+            overflowSlots[x] = i + 1;
+        }
+    }
+    inline uint64_t overflowSlot(const keyType &k) const {
+        return (((uint64_t) std::hash<keyType>()(k)) * 0x9E3779B97F4A7C15ULL) >> overflowShift;
+    }
+    static const uint32_t FLAG_OVERFLOW = 1; //!< the overflow table is stored after the array, see exportInfo().
+    static const uint32_t FLAG_VALUEMAP = 2; //!< the value map is stored after the overflow table, see exportInfo().
+    /*!
+     \brief if not empty, the Othello stores codes instead of values, and a query of a key returns valueMap[code].
+     \note set by setValueMap(), which pads it to 2^L entries, so that any code read from the array is mapped.
+     */
+    vector<valueType> valueMap;
+    /*!
+     \brief the value of code *i* is *values[i]*. The values given to the constructor, and those of the overflow table, are codes.
+     */
+    void setValueMap(const vector<valueType> &values) {
+        valueMap.clear();
+        if (values.empty()) return;
+        if (L > 24 || values.size() > (1ULL << L))
+            throw std::invalid_argument("too many values to map for L");
+        valueMap = values;
+        valueMap.resize(1ULL << L, 0);
+    }
+    uint32_t threads = 1; //!< number of threads used during construction.
     static double getrate(uint32_t ma, uint32_t mb, uint32_t da, uint32_t db);
-private:
+protected:
     bool autoclear = false; //!<  clears the memory allocated during construction automatically.
     const keyType *keys;
     /*!
@@ -142,6 +375,36 @@ private:
 
 
 
+    //! \brief get() that may run while other threads setConcurrent() the neighbouring cells.
+    inline valueType getConcurrent(uint32_t loc) {
+        uint64_t st = ((uint64_t) loc) * L;
+        uint32_t mx = st & 0x3F;
+        valueType lo = __atomic_load_n(&mem[st>>6], __ATOMIC_RELAXED);
+        if ( (L & (L-1)) && (mx + L) > 64 )
+            return ((lo>>mx) | (__atomic_load_n(&mem[(st>>6)+1], __ATOMIC_RELAXED)<<(64-mx)));
+        return (lo>>mx);
+    }
+
+    /*!
+     * \brief set() that may run while other threads setConcurrent() the neighbouring cells.
+     * \note cells sharing a word are updated by atomic and/or, the cell itself must be owned by the calling thread.
+     */
+    valueType inline setConcurrent(uint32_t loc, valueType &value) {
+        value &= LMASK;
+        uint64_t st = ((uint64_t) loc) * L;
+        uint32_t mx = st & 0x3F;
+        if ( (L & (L-1)) && (mx + L) > 64 ) {
+            __atomic_fetch_and(&mem[st>>6], ((UINT64_MAX) >> (64-mx)), __ATOMIC_RELAXED);
+            __atomic_fetch_or(&mem[st>>6], (value << mx), __ATOMIC_RELAXED);
+            __atomic_fetch_and(&mem[(st>>6)+1], (UINT64_MAX << ((mx+L)-64)), __ATOMIC_RELAXED);
+            __atomic_fetch_or(&mem[(st>>6)+1], (value >> (64-mx)), __ATOMIC_RELAXED);
+            return value;
+        }
+        __atomic_fetch_and(&mem[st>>6], (~(LMASK << mx)), __ATOMIC_RELAXED);
+        __atomic_fetch_or(&mem[st>>6], (value << mx), __ATOMIC_RELAXED);
+        return value;
+    }
+
     valueType inline set(uint32_t loc, valueType &value) {
         value &= LMASK;
         uint64_t st = ((uint64_t) loc) * L;
@@ -172,19 +435,52 @@ private:
     void newHash() {
         uint32_t s1 = rand();
         uint32_t s2 = rand();
+        //! a seed with (s & 7) == 0 clears the CRC in Hasher32, leaving only the xor of the key halves.
+        while ((s1 & 7) == 0) s1 = rand();
+        while ((s2 & 7) == 0) s2 = rand();
 #ifdef HASHSEED1
         s1 = HASHSEED1;
         s2 = HASHSEED2;
 #endif
-        Ha.setMaskSeed(ma-1,s1);
-        Hb.setMaskSeed(mb-1,s2);
+        //! the blocked layout maps the full 32-bit hash values to a block and cells.
+        if (blockbytes) {
+            Ha.setMaskSeed(~0U,s1);
+            Hb.setMaskSeed(~0U,s2);
+        }
+        else {
+            Ha.setRangeSeed(ma,s1);
+            Hb.setRangeSeed(mb,s2);
+        }
+        if (mc) {
+            uint32_t s3 = rand();
+            while ((s3 & 7) == 0 || s3 == s1 || s3 == s2) s3 = rand();
+            Hc.setRangeSeed(mc,s3);
+        }
         trycount++;
         if (trycount>1) printf("%s: NewHash for the %d time\n", get_thid().c_str(), trycount);
     }
 
-    vector<int32_t> *first, *nxt1, *nxt2;
+    //! \brief an edge of the graph, seen from one of its ends.
+    struct AdjEntry {
+        uint32_t node; //!< the other end of the edge.
+        uint32_t kid;  //!< the key of the edge.
+    };
+    vector<uint32_t> offsets; //!< CSR of the graph, the edges incident to node x are adj[offsets[x]..offsets[x+1]-1].
+    vector<AdjEntry> adj;  //!< CSR of the graph.
+    vector<uint32_t> removedIdx; //!< sorted ids of the removed keys.
     bool testHash(uint32_t keycount);
-    vector<bool> filled;
+    bool testHashConcurrent(uint32_t keycount);
+    static constexpr double BLOCK_LOAD = 0.4; //!< initial number of keys per cell in the blocked layout.
+    bool buildBlocked(void *values, uint32_t keycount, size_t valuesize, uint32_t _blockbytes);
+    bool trybuildBlocked(void *values, uint32_t keycount, size_t valuesize);
+    void buildGraph(uint32_t keycount);
+    vector<uint64_t> filled; //!< bitmap, a node is filled if its value is determined by the keys.
+    inline bool isfilled(uint32_t i) const {
+        return (__atomic_load_n(&filled[i>>6], __ATOMIC_RELAXED) >> (i & 63)) & 1;
+    }
+    inline void markfilled(uint32_t i) {
+        __atomic_fetch_or(&filled[i>>6], 1ULL << (i & 63), __ATOMIC_RELAXED);
+    }
 
     /*!
      \brief Fill *Othello* so that the query returns values as defined.
@@ -195,18 +491,72 @@ private:
 
     */
     void fillvalue(void *values/*, uint32_t keycount*/, size_t valuesize);
+    /*!
+     \brief fill the connected component of *root*, whose value is set to *rootvalue*.
+     \note when *concurrent* is true, other components may be filled by other threads at the same time.
+     */
+    template <bool concurrent>
+    void fillcomponent(uint32_t root, valueType rootvalue, void *values, size_t valuesize, vector<uint32_t> &Q);
+    //! \brief runs func(st, ed) on *threads* threads, the ranges [st, ed) split [0, n).
+    template <typename F>
+    void runThreads(uint64_t n, F func) {
+        if (threads <= 1) {
+            func(0, n);
+            return;
+        }
+        vector<thread> vth;
+        for (uint32_t t = 0; t < threads; t++)
+            vth.push_back(thread(func, n * t / threads, n * (t+1) / threads));
+        for (auto &th : vth)
+            th.join();
+    }
     bool trybuild( void *values, uint32_t keycount, size_t valuesize) {
         bool succ;
         disj.setLength(ma+mb);
         printf("%s: Tot number of keys %d\n", get_thid().c_str(), keycount);
-        if ((succ = testHash(keycount))) {
+        if ((succ = (threads > 1) ? testHashConcurrent(keycount) : testHash(keycount))) {
+            //! the sequential fillvalue() does not need the disjoint sets, release them before the CSR is allocated.
+            if (autoclear && threads <= 1) disj.finish();
+            buildGraph(keycount);
             fillvalue(values, valuesize);
         }
         if (autoclear || (!succ))
             finishBuild();
         return succ;
     }
+protected:
+    //! \brief an empty Othello, to be built by a derived class, see Othello3.
+    Othello() {}
+    static constexpr double PEEL_LOAD = 1.23; //!< initial number of cells per key in the three-hash layout.
+    bool buildPeeled(void *values, uint32_t keycount, size_t valuesize);
+    /*!
+     \brief put the removed keys and their values in the overflow table.
+     \note the keys are found by a binary search of each key among the sorted removed keys.
+     */
+    void buildOverflow(void *values, uint32_t keycount, size_t valuesize) {
+        overflowKeys.clear();
+        overflowValues.clear();
+        if (values == NULL || removedKeys.empty()) return;
+        vector<keyType> removed(removedKeys);
+        sort(removed.begin(), removed.end());
+        vector<pair<keyType, valueType>> kv;
+        for (uint32_t i = 0; i < keycount; i++)
+            if (binary_search(removed.begin(), removed.end(), keys[i])) {
+                valueType v = 0;
+                memcpy(&v, ((uint8_t *) values) + ((uint64_t) i) * valuesize, valuesize);
+                kv.push_back(make_pair(keys[i], v & LMASK));
+            }
+        sort(kv.begin(), kv.end());
+        for (auto &p : kv) {
+            overflowKeys.push_back(p.first);
+            overflowValues.push_back(p.second);
+        }
+        indexOverflow();
+        printf("%s: %lu removed keys are kept in the overflow table\n", get_thid().c_str(), overflowKeys.size());
+    }
+    bool trybuildPeeled(void *values, uint32_t keycount, size_t valuesize);
 public:
+    virtual ~Othello() {}
     /*!
      \brief Construct *l-Othello*.
      \param [in] keyType *_keys, pointer to array of keys.
@@ -215,54 +565,61 @@ public:
      \param [in] void * _values, Optional, pointer to array of values. When *_values* is empty, fill othello values such that the query result classifies keys to 2 sets. See more in notes.
      \param [in] uint32_t valuesize, must be specifed when *_values* is not NULL. This indicates the length of a valueType;
      \param [in] _allowed_conflicts, default value is 10. during construction, Othello will remove at most this number of keys, instead of rehash.
+     \param [in] uint32_t _threads, number of threads used to test the acyclicity and to fill the values.
+     \param [in] uint32_t _blockbytes, 0 for the classic layout, otherwise the block size of the blocked layout, e.g., 64 or 4096. *_values* must be given.
      \note keycount should not exceed 2^29 for memory consideration.
      \n when *_values* is empty, classify keys into two sets X and Y, defined as follow: for each connected compoenents in G, select a node as the root, mark all edges in this connected compoenent as pointing away from the root. for all edges from U to V, query result is 1 (k in Y), for all edges from V to u, query result is 0 (k in X).
 
     */
-    Othello(uint8_t _L,  keyType *_keys,  uint32_t keycount, bool _autoclear = true,  void *_values = NULL, size_t _valuesize = 0, int32_t _allowed_conflicts = -1 ) {
+    Othello(uint8_t _L,  keyType *_keys,  uint32_t keycount, bool _autoclear = true,  void *_values = NULL, size_t _valuesize = 0, int32_t _allowed_conflicts = -1, uint32_t _threads = 1, uint32_t _blockbytes = 0) {
         printf("%s : Construct Othello with %u keys.\n", get_thid().c_str(), keycount);
         allowed_conflicts = _allowed_conflicts;
+        threads = (_threads < 1) ? 1 : _threads;
         L = _L;
+        gather = selectOthelloGather(L);
         autoclear = _autoclear;
         keys = _keys;
-        int hl1 = 8; //start from ma=64
-        int hl2 = 7; //start from mb=64
-        while ((1UL<<hl2) <  keycount * 1) hl2++;
-        while ((1UL<<hl1) < keycount* 1.333334) hl1++;
-        ma = (1UL<<hl1);
-        mb = (1UL<<hl2);
-        mem.resize(1);
+        if (_blockbytes) {
+            if (_allowed_conflicts < 0) allowed_conflicts = 0;
+            build = buildBlocked(_values, keycount, _valuesize, _blockbytes);
+            if (build) buildOverflow(_values, keycount, _valuesize);
+            stringstream ss;
+            if (build)
+                ss << "Succ " << human(keycount) <<" Keys, "<< human(nblocks) << " blocks of " << blockbytes << " bytes, L="<<(int) L << endl;
+            else
+                ss << "Build Fail!" << endl;
+            printf("%s :%s \n", get_thid().c_str(), ss.str().c_str());
+            return;
+        }
+        //! the lengths are not rounded to powers of two, the hash values are reduced to them by multiply-shift.
+        uint64_t la = (uint64_t) (keycount * 1.333334) + 1;
+        uint64_t lb = keycount;
+        if (la < 64) la = 64; //start from ma=64
+        if (lb < 64) lb = 64; //start from mb=64
+        ma = la;
+        mb = lb;
         if (_allowed_conflicts<0) {
-            allowed_conflicts = (ma<20)?0:(hl1+hl2)*5;
+            int hl = 0;
+            while ((1ULL<<hl) < la * lb) hl++;
+            allowed_conflicts = (ma<20)?0:hl*5;
         }
-        uint64_t bitcnt = (ma+mb);
-        bitcnt *= L;
-        while (bitcnt % (sizeof(valueType)*8)) bitcnt++;
-        bitcnt /= (sizeof(valueType)*8);
-        mem.resize(bitcnt,0ULL);
-        while ( ((uint64_t)mem.size())*sizeof(mem[0])*8ULL<(ma+mb)*((uint64_t)L) )
-            mem.push_back(0);
+        mem.resize(memSize());
 
 
         trycount = 0;
-        while ( (!build) && (hl1<=31&&hl2<=31)) {
+        while ( (!build) && (la <= (1ULL<<31) && lb <= (1ULL<<31))) {
             while ((!build) && (trycount<MAX_REHASH)) {
                 newHash();
                 build = trybuild( _values, keycount, _valuesize);
             }
             if (!build) {
-                if (hl1 == hl2) hl1++;
-                else hl2++;
-                ma = (1UL<<hl1);
-                mb = (1UL<<hl2);
-                mem.resize(1);
-                uint64_t bitcnt = (ma+mb);
-                bitcnt *= L;
-                while (bitcnt % (sizeof(valueType)*8)) bitcnt++;
-                bitcnt /= (sizeof(valueType)*8);
-                mem.resize(bitcnt,0ULL);
-                while ( ((uint64_t)mem.size())*sizeof(mem[0])*8ULL<(ma+mb)*((uint64_t)L) )
-                    mem.push_back(0);
+                //! grow both arrays by about 8%, instead of doubling one of them.
+                la += la / 12 + 1;
+                lb += lb / 12 + 1;
+                if (la > (1ULL<<31) || lb > (1ULL<<31)) break;
+                ma = la;
+                mb = lb;
+                mem.resize(memSize());
 
                 stringstream ss;
                 ss << "Extend Othello Length to" << human(keycount) <<" Keys, ma/mb = " << human(ma) <<"/"<<human(mb) <<" keyT"<< sizeof(keyType)*8<<"b  valueT" << sizeof(valueType)*8<<"b"<<" L="<<(int) L<<endl;
@@ -270,6 +627,7 @@ public:
                 trycount = 0;
             }
         }
+        if (build) buildOverflow(_values, keycount, _valuesize);
         stringstream ss;
         if (build)
             ss << "Succ " << human(keycount) <<" Keys, ma/mb = " << human(ma) <<"/"<<human(mb) <<" keyT"<< sizeof(keyType)*8<<"b  valueT" << sizeof(valueType)*8<<"b"<<" L="<<(int) L <<" After "<<trycount << "tries"<< endl;
@@ -280,82 +638,120 @@ public:
     }
     //!\brief Construct othello with vectors.
     template<typename VT>
-    Othello(uint8_t _L,  vector<keyType> &keys,  vector<VT> &values, bool _autoclear = true, int32_t allowed_conflicts = -1) :
-        Othello(_L, & (keys[0]),keys.size(), _autoclear, &(values[0]), sizeof(VT), allowed_conflicts)
+    Othello(uint8_t _L,  vector<keyType> &keys,  vector<VT> &values, bool _autoclear = true, int32_t allowed_conflicts = -1, uint32_t threads = 1, uint32_t blockbytes = 0) :
+        Othello(_L, & (keys[0]),keys.size(), _autoclear, &(values[0]), sizeof(VT), allowed_conflicts, threads, blockbytes)
     {
     }
 
     //!\brief Construct othello with vectors.
     template<typename VT>
-    Othello(uint8_t _L,  IOBuf<keyType> &keys,  IOBuf<VT> &values, bool _autoclear = true, int32_t allowed_conflicts = -1) :
-        Othello(_L, keys.getstart(), keys.size(), _autoclear, values.getstart(), sizeof(VT), allowed_conflicts)
+    Othello(uint8_t _L,  IOBuf<keyType> &keys,  IOBuf<VT> &values, bool _autoclear = true, int32_t allowed_conflicts = -1, uint32_t threads = 1, uint32_t blockbytes = 0) :
+        Othello(_L, keys.getstart(), keys.size(), _autoclear, values.getstart(), sizeof(VT), allowed_conflicts, threads, blockbytes)
     {
     }
 
     //! \brief release memory space used during construction and forbid future modification of arrayA and arrayB.
     void finishBuild() {
-        delete nxt1;
-        delete nxt2;
-        delete first;
+        removedIdx.clear();
+        offsets.clear();
+        offsets.shrink_to_fit();
+        adj.clear();
+        adj.shrink_to_fit();
         disj.finish();
         filled.clear();
+        filled.shrink_to_fit();
     }
 
     /*!
         \brief export the information of the *Othello*, not including the array, to a memory space.
         \note memory space length = 0x20. \n
               Exported infomation contains:  \n
-              0x00, 32bit, L; \n
+              0x00, 16bit, L; \n
+              0x02, 16bit, flags, FLAG_OVERFLOW if the overflow table is stored after the array, FLAG_VALUEMAP if the value map is stored after it; \n
               0x04, 32bit, seedB; \n
               0x08, 32bit, seedA; \n
+              0x0C, 32bit, blockbytes, 0 for the classic layout; \n
               0x10, 8bit, hlA;
-              0x14, 8bit, hlB;
-              seedA, seedB, ma , mb (represented as 1<<hl1 and 1<<hl2).
+              0x14, 8bit, hlB, or 3 for the three-hash layout if hlA is 0;
+              0x18, 32bit, nblocks of the blocked layout, or ma if hlA is 0; \n
+              0x1C, 32bit, mb if hlA and hlB are 0, or the seed of Hc in the three-hash layout; \n
+              seedA, seedB, ma , mb (represented as 1<<hl1 and 1<<hl2 for Othellos hashed with bitmasks).
     */
     void exportInfo(unsigned char * v) {
         memset(v,0,0x20);
         uint32_t s1 = Ha.s;
         uint32_t s2 = Hb.s;
-        memcpy(v,&L, sizeof(uint32_t));
+        uint32_t lflags = L | ((overflowKeys.empty() ? 0 : FLAG_OVERFLOW) << 16) | ((valueMap.empty() ? 0 : FLAG_VALUEMAP) << 16);
+        memcpy(v,&lflags, sizeof(uint32_t));
         memcpy(v+4,&s1,sizeof(uint32_t));
         memcpy(v+8,&s2,sizeof(uint32_t));
         int hl1 = 0, hl2 = 0;
-        if (ma == 0 || mb ==0) {
+        if (ma == 0 || mb ==0 || Ha.range) {
             hl1 = hl2 = 0;
         }
         else {
             while ((1U<<hl1)!= ma) hl1++;
             while ((1U<<hl2)!= mb) hl2++;
         }
+        if (mc)
+            hl2 = 3;
         memcpy(v+0x10,&hl1, sizeof(uint32_t));
         memcpy(v+0x14,&hl2,sizeof(uint32_t));
+        memcpy(v+0x0C,&blockbytes,sizeof(uint32_t));
+        if (blockbytes)
+            memcpy(v+0x18,&nblocks,sizeof(uint32_t));
+        else if (mc) {
+            uint32_t s3 = Hc.s;
+            memcpy(v+0x18,&ma,sizeof(uint32_t));
+            memcpy(v+0x1C,&s3,sizeof(uint32_t));
+        }
+        else if (Ha.range) {
+            memcpy(v+0x18,&ma,sizeof(uint32_t));
+            memcpy(v+0x1C,&mb,sizeof(uint32_t));
+        }
     }
     /*!
        \brief load the infomation of the *Othello* from memory.
-       \note info is exported using *ExportInro()*
+       \note info is exported using *ExportInro()*. The arrays are not allocated until the data is loaded.
      */
     Othello(unsigned char *v) {
         int32_t hl1,hl2;
         int32_t s1,s2;
         memcpy(&(L),v,sizeof(uint32_t));
+        flags = L >> 16;
+        L &= 0xFFFF;
+        gather = selectOthelloGather(L);
         memcpy(&(s1),v+4,sizeof(uint32_t));
         memcpy(&(s2),v+8,sizeof(uint32_t));
         memcpy(&hl1, v+0x10, sizeof(uint32_t));
         memcpy(&hl2, v+0x14, sizeof(uint32_t));
-        if (hl1 > 0 && hl2 >0) {
+        uint32_t _blockbytes, _nblocks, _mb;
+        memcpy(&_blockbytes, v+0x0C, sizeof(uint32_t));
+        memcpy(&_nblocks, v+0x18, sizeof(uint32_t));
+        memcpy(&_mb, v+0x1C, sizeof(uint32_t));
+        if (_blockbytes) {
+            setBlockLayout(_blockbytes, _nblocks);
+            Ha.setMaskSeed(~0U,s1);
+            Hb.setMaskSeed(~0U,s2);
+        }
+        else if (hl1 > 0 && hl2 >0) {
             ma = (1<<hl1);
             mb = (1<<hl2);
-            mem.resize(1);
-            uint64_t bitcnt = (ma+mb);
-            bitcnt *= L;
-            while (bitcnt % (sizeof(valueType)*8)) bitcnt++;
-            bitcnt /= (sizeof(valueType)*8);
-            mem.resize(bitcnt,0ULL);
-            while ( ((uint64_t)mem.size())*sizeof(mem[0])*8ULL<(ma+mb)*((uint64_t)L) )
-                mem.push_back(0);
             Ha.setMaskSeed(ma-1,s1);
             Hb.setMaskSeed(mb-1,s2);
         }
+        else if (hl1 == 0 && hl2 == 3) {
+            ma = mb = mc = _nblocks;
+            Ha.setRangeSeed(ma,s1);
+            Hb.setRangeSeed(mb,s2);
+            Hc.setRangeSeed(mc,_mb);
+        }
+        else if (_nblocks > 0 && _mb > 0) {
+            ma = _nblocks;
+            mb = _mb;
+            Ha.setRangeSeed(ma,s1);
+            Hb.setRangeSeed(mb,s2);
+        }
         else
             ma = mb =0;
     }
@@ -364,8 +760,54 @@ public:
        \brief returns a 64-bit integer query value for a key.
     */
     uint64_t queryInt(const keyType &k) {
-        uint32_t ha,hb;
-        return query(k,ha,hb);
+        uint64_t ret;
+        if (blockbytes)
+            ret = queryBlocked(Ha(k), Hb(k));
+        else if (mc)
+            ret = LMASK & (get(Ha(k)) ^ get(ma + Hb(k)) ^ get(ma + mb + Hc(k)));
+        else {
+            uint32_t ha,hb;
+            ret = query(k,ha,hb);
+        }
+        if (!overflowKeys.empty())
+            queryOverflow(k, ret);
+        if (!valueMap.empty())
+            ret = valueMap[ret];
+        return ret;
+    }
+    //! \brief if *k* is in the overflow table, set *value* to its value.
+    inline void queryOverflow(const keyType &k, uint64_t &value) const {
+        for (uint64_t x = overflowSlot(k); overflowSlots[x]; x = (x + 1) & (overflowSlots.size() - 1))
+            if (overflowKeys[overflowSlots[x] - 1] == k) {
+                value = overflowValues[overflowSlots[x] - 1];
+                return;
+            }
+    }
+
+    //! \brief the block of a key whose Ha is *ha*, in the blocked layout.
+    inline uint32_t blockOf(uint32_t ha) const {
+        return (((uint64_t) ha) * nblocks) >> 32;
+    }
+    //! \brief the cells of a key whose hash values are *ha* and *hb*, relative to its block with seed *t*.
+    inline void blockCells(uint32_t ha, uint32_t hb, uint32_t t, uint32_t &ca, uint32_t &cb) const {
+        uint64_t x = ((((uint64_t) hb) << 32) | ha) ^ (t * 0x9E3779B97F4A7C15ULL);
+        x *= 0xD6E8FEB86659FD93ULL;
+        x ^= x >> 32;
+        ca = ((x & 0xFFFFFFFFULL) * blockA) >> 32;
+        cb = blockA + (((x >> 32) * blockB) >> 32);
+    }
+    inline uint32_t blockSeed(const valueType *blk) const {
+        return blk[blockbytes / 8 - 1] >> (64 - BLOCK_SEED_BITS);
+    }
+    /*!
+     \brief query in the blocked layout, *ha* and *hb* are the full 32-bit hash values of the key.
+     \note the seed and both cells are in one block, i.e., one cache line for 64-byte blocks, one page for 4096-byte blocks.
+     */
+    inline valueType queryBlocked(uint32_t ha, uint32_t hb) {
+        const valueType *blk = mem.data() + ((uint64_t) blockOf(ha)) * (blockbytes / 8);
+        uint32_t ca, cb;
+        blockCells(ha, hb, blockSeed(blk), ca, cb);
+        return othelloCell(blk, L, ca) ^ othelloCell(blk, L, cb);
     }
 
 
@@ -410,23 +852,231 @@ public:
         get_hash_1(v,ret1);
         get_hash_2(v,ret2);
     }
+    //! \brief compute get_hash() of *n* keys.
+    void get_hash_batch(const keyType *k, size_t n, uint32_t *ha, uint32_t *hb) {
+        Ha.hashBatch(k, n, ha);
+        Hb.hashBatch(k, n, hb);
+        for (size_t i = 0; i < n; i++)
+            hb[i] += ma;
+    }
+    //! \brief issue software prefetches for the cells at ha and hb, as computed by get_hash().
+    inline void prefetch(uint32_t ha, uint32_t hb) const {
+        __builtin_prefetch(&mem[(((uint64_t) ha) * L) >> 6]);
+        __builtin_prefetch(&mem[(((uint64_t) hb) * L) >> 6]);
+    }
+    //! \brief returns the query value for the key whose hash values are ha and hb, as computed by get_hash().
+    inline valueType queryHashed(uint32_t ha, uint32_t hb) {
+        return LMASK & (get(ha)^get(hb));
+    }
+    static const uint32_t QUERY_WINDOW = 16; //!< number of keys in flight in queryBatch(), must be a power of 2.
+    /*!
+     \brief query *n* keys, out[i] is the query value of k[i].
+     \note The hash values of the next QUERY_WINDOW keys are computed by get_hash_batch() and their cells prefetched
+      before the values of the current window are gathered, so that the cache misses of these keys overlap.
+      The values are gathered by the kernel specialized for L, see selectOthelloGather().
+     */
+    void queryBatch(const keyType *k, size_t n, uint64_t *out) {
+        if (blockbytes)
+            queryBatchBlocked(k, n, out);
+        else if (mc)
+            queryBatch3(k, n, out);
+        else
+            queryBatch2(k, n, out);
+        if (!overflowKeys.empty())
+            for (size_t i = 0; i < n; i++)
+                queryOverflow(k[i], out[i]);
+        if (!valueMap.empty())
+            for (size_t i = 0; i < n; i++)
+                out[i] = valueMap[out[i]];
+    }
+    //! \brief queryBatch() in the classic layout.
+    void queryBatch2(const keyType *k, size_t n, uint64_t *out) {
+        uint32_t ha[2][QUERY_WINDOW], hb[2][QUERY_WINDOW];
+        auto issue = [&](size_t st, uint32_t w) {
+            size_t cnt = (n - st < QUERY_WINDOW) ? (n - st) : QUERY_WINDOW;
+            get_hash_batch(k + st, cnt, ha[w], hb[w]);
+            for (size_t i = 0; i < cnt; i++)
+                prefetch(ha[w][i], hb[w][i]);
+        };
+        if (n) issue(0, 0);
+        for (size_t st = 0; st < n; st += QUERY_WINDOW) {
+            uint32_t w = (st / QUERY_WINDOW) & 1;
+            if (st + QUERY_WINDOW < n)
+                issue(st + QUERY_WINDOW, w ^ 1);
+            size_t cnt = (n - st < QUERY_WINDOW) ? (n - st) : QUERY_WINDOW;
+            gather(mem.data(), L, ha[w], hb[w], cnt, out + st);
+        }
+    }
+    //! \brief compute the cells of *n* keys in the three-hash layout, i.e., get_hash_batch() and hc[i] = Hc(k[i]) + ma + mb.
+    void get_hash3_batch(const keyType *k, size_t n, uint32_t *ha, uint32_t *hb, uint32_t *hc) {
+        get_hash_batch(k, n, ha, hb);
+        Hc.hashBatch(k, n, hc);
+        for (size_t i = 0; i < n; i++)
+            hc[i] += ma + mb;
+    }
+    //! \brief queryBatch() in the three-hash layout, the cells of Ha and Hb are gathered by the kernel for L.
+    void queryBatch3(const keyType *k, size_t n, uint64_t *out) {
+        uint32_t ha[2][QUERY_WINDOW], hb[2][QUERY_WINDOW], hc[2][QUERY_WINDOW];
+        auto issue = [&](size_t st, uint32_t w) {
+            size_t cnt = (n - st < QUERY_WINDOW) ? (n - st) : QUERY_WINDOW;
+            get_hash3_batch(k + st, cnt, ha[w], hb[w], hc[w]);
+            for (size_t i = 0; i < cnt; i++) {
+                prefetch(ha[w][i], hb[w][i]);
+                __builtin_prefetch(&mem[(((uint64_t) hc[w][i]) * L) >> 6]);
+            }
+        };
+        if (n) issue(0, 0);
+        for (size_t st = 0; st < n; st += QUERY_WINDOW) {
+            uint32_t w = (st / QUERY_WINDOW) & 1;
+            if (st + QUERY_WINDOW < n)
+                issue(st + QUERY_WINDOW, w ^ 1);
+            size_t cnt = (n - st < QUERY_WINDOW) ? (n - st) : QUERY_WINDOW;
+            gather(mem.data(), L, ha[w], hb[w], cnt, out + st);
+            for (size_t i = 0; i < cnt; i++)
+                out[st + i] ^= othelloCell(mem.data(), L, hc[w][i]);
+        }
+    }
+    //! \brief queryBatch() in the blocked layout, the seed word of each block is prefetched.
+    void queryBatchBlocked(const keyType *k, size_t n, uint64_t *out) {
+        uint32_t ha[2][QUERY_WINDOW], hb[2][QUERY_WINDOW];
+        const uint32_t W = blockbytes / 8;
+        auto issue = [&](size_t st, uint32_t w) {
+            size_t cnt = (n - st < QUERY_WINDOW) ? (n - st) : QUERY_WINDOW;
+            Ha.hashBatch(k + st, cnt, ha[w]);
+            Hb.hashBatch(k + st, cnt, hb[w]);
+            for (size_t i = 0; i < cnt; i++)
+                __builtin_prefetch(mem.data() + ((uint64_t) blockOf(ha[w][i])) * W + W - 1);
+        };
+        if (n) issue(0, 0);
+        for (size_t st = 0; st < n; st += QUERY_WINDOW) {
+            uint32_t w = (st / QUERY_WINDOW) & 1;
+            if (st + QUERY_WINDOW < n)
+                issue(st + QUERY_WINDOW, w ^ 1);
+            size_t cnt = (n - st < QUERY_WINDOW) ? (n - st) : QUERY_WINDOW;
+            for (size_t i = 0; i < cnt; i++)
+                out[st + i] = queryBlocked(ha[w][i], hb[w][i]);
+        }
+    }
     /*!
      \brief load the array from file.
      \note only the arrayA and B are loaded. This must be called after using constructor Othello<keyType>::Othello(unsigned char *)
      */
     bool loaded = false;
+    uint32_t flags = 0; //!< flags of the header, see exportInfo().
+    //! \brief read the overflow table, stored by writeOverflow() after the array.
+    bool loadOverflow(gzFile f) {
+        uint64_t cnt = 0;
+        if (gzread(f, &cnt, sizeof(cnt)) != sizeof(cnt)) return false;
+        overflowKeys.resize(cnt);
+        overflowValues.resize(cnt);
+        if (cnt == 0) return true;
+        if (gzread(f, &overflowKeys[0], cnt * sizeof(keyType)) != (int) (cnt * sizeof(keyType)) ||
+                gzread(f, &overflowValues[0], cnt * sizeof(valueType)) != (int) (cnt * sizeof(valueType)))
+            return false;
+        indexOverflow();
+        return true;
+    }
+    //! \brief read the value map, stored by writeValueMap() after the overflow table.
+    bool loadValueMap(gzFile f) {
+        uint64_t cnt = 0;
+        if (gzread(f, &cnt, sizeof(cnt)) != sizeof(cnt) || cnt == 0 || cnt > (1ULL << L)) return false;
+        vector<valueType> values(cnt);
+        if (gzread(f, &values[0], cnt * sizeof(valueType)) != (int) (cnt * sizeof(valueType)))
+            return false;
+        setValueMap(values);
+        return true;
+    }
+    //! \brief write the value map: the number of values, and then the values, without the padding.
+    void writeValueMap(gzFile f) {
+        uint64_t cnt = valueMap.size();
+        while (cnt > 1 && valueMap[cnt - 1] == 0) cnt--;
+        gzwrite(f, &cnt, sizeof(cnt));
+        gzwrite(f, &valueMap[0], cnt * sizeof(valueType));
+    }
+    //! \brief write the overflow table: the number of keys, the keys, and then the values.
+    void writeOverflow(gzFile f) {
+        uint64_t cnt = overflowKeys.size();
+        gzwrite(f, &cnt, sizeof(cnt));
+        if (cnt == 0) return;
+        gzwrite(f, &overflowKeys[0], cnt * sizeof(keyType));
+        gzwrite(f, &overflowValues[0], cnt * sizeof(valueType));
+    }
     void loadDataFromBinaryFile(FILE *pF) {
-        if (mem.size()==0) return ;
+        if (memSize()==0) return ;
+        mem.resize(memSize());
         auto resp = fread(&(mem[0]),sizeof(mem[0]), mem.size(), pF);
         if (resp == mem.size()*sizeof(mem[0]))
             loaded = true;
 
     }
     void loadDataFromGzipFile(gzFile f) {
-        if (mem.size()==0) return ;
+        if (memSize()==0) return ;
+        mem.resize(memSize());
         unsigned int resp = gzread(f, &(mem[0]), sizeof(mem[0]) * mem.size());
         if (resp == mem.size()*sizeof(mem[0]))
             loaded = true;
+        if ((flags & FLAG_OVERFLOW) && !loadOverflow(f))
+            loaded = false;
+        if ((flags & FLAG_VALUEMAP) && !loadValueMap(f))
+            loaded = false;
+    }
+    /*!
+     \brief load the array from file *fname*, which is opened as *f*.
+     \note When the file is written by writeDataToMappableFile(), the arrays are mapped from the file and queried in place,
+      or read into huge pages if set by hugePageMode(). Otherwise they are inflated to the heap. In both cases *f* is positioned after the arrays.
+     */
+    void loadDataFromFile(gzFile f, const char *fname) {
+        if (memSize()==0) return ;
+        if (!gzdirect(f)) {
+            loadDataFromGzipFile(f);
+            return;
+        }
+        uint64_t offset = alignToMappablePage(gztell(f));
+        uint64_t bytes = memSize() * sizeof(valueType);
+        //! huge pages can not back a file mapping, so the array is read into them, see hugePageMode().
+        if (hugePageMode() != HUGEPAGE_NONE && bytes >= LARGE_ARRAY_BYTES) {
+            mem.resize(memSize());
+            gzseek(f, offset, SEEK_SET);
+            uint8_t *p = (uint8_t *) mem.data();
+            uint64_t left = bytes;
+            while (left) {
+                unsigned int chunk = (left > (1U<<30)) ? (1U<<30) : left;
+                if (gzread(f, p, chunk) != (int) chunk) return;
+                p += chunk;
+                left -= chunk;
+            }
+            loaded = true;
+            if ((flags & FLAG_OVERFLOW) && !loadOverflow(f))
+                loaded = false;
+            if ((flags & FLAG_VALUEMAP) && !loadValueMap(f))
+                loaded = false;
+            return;
+        }
+        if (mem.mapFile(fname, offset, memSize())) {
+            loaded = true;
+            gzseek(f, offset + bytes, SEEK_SET);
+            if ((flags & FLAG_OVERFLOW) && !loadOverflow(f))
+                loaded = false;
+            if ((flags & FLAG_VALUEMAP) && !loadValueMap(f))
+                loaded = false;
+        }
+    }
+    /*!
+     \brief a copy of the loaded Othello, whose array is allocated on NUMA node *node*, see MemArray::allocOnNode().
+     */
+    Othello<keyType> * replicateOnNode(int node) {
+        unsigned char buf[0x20];
+        exportInfo(buf);
+        Othello<keyType> *oth = new Othello<keyType>(buf);
+        oth->mem.allocOnNode(memSize(), node);
+        if (memSize())
+            memcpy(oth->mem.data(), mem.data(), memSize() * sizeof(mem[0]));
+        oth->overflowKeys = overflowKeys;
+        oth->overflowValues = overflowValues;
+        oth->indexOverflow();
+        oth->valueMap = valueMap;
+        oth->loaded = loaded;
+        return oth;
     }
     /*!
      \brief write array to binary file.
@@ -436,6 +1086,32 @@ public:
     }
     void writeDataToGzipFile(gzFile f) {
         gzwrite(f, &(mem[0]),sizeof(mem[0])*mem.size());
+        if (!overflowKeys.empty())
+            writeOverflow(f);
+        if (!valueMap.empty())
+            writeValueMap(f);
+    }
+    /*!
+     \brief write array uncompressed, starting at the next page boundary, so that it can be mapped by loadDataFromFile().
+     \note *f* must be opened with mode "wbT".
+     */
+    void writeDataToMappableFile(gzFile f) {
+        uint64_t pos = gztell(f);
+        vector<uint8_t> pad(alignToMappablePage(pos) - pos, 0);
+        if (pad.size())
+            gzwrite(f, &pad[0], pad.size());
+        uint8_t *p = (uint8_t *) &(mem[0]);
+        uint64_t bytes = sizeof(mem[0])*mem.size();
+        while (bytes) {
+            unsigned int chunk = (bytes > (1U<<30)) ? (1U<<30) : bytes;
+            gzwrite(f, p, chunk);
+            p += chunk;
+            bytes -= chunk;
+        }
+        if (!overflowKeys.empty())
+            writeOverflow(f);
+        if (!valueMap.empty())
+            writeValueMap(f);
     }
     void getrates(std::map<int, double> &sum);
 private:
@@ -455,6 +1131,52 @@ private:
     }
 };
 
+/*!
+ \brief An Othello with three hash functions. It needs about 1.23n cells instead of 2.33n for n keys.
+ \note A key is an edge of a 3-hypergraph on arrayA, arrayB and arrayC, and its query value is the xor of its three cells.
+  The hypergraph is built by peeling, see Othello::trybuildPeeled(). The values of the keys must be given.
+  Once built, it is exported, loaded and queried as an Othello, whose header records the layout, see Othello::exportInfo().
+ */
+template <class keyType>
+class Othello3 : public Othello<keyType> {
+public:
+    Othello3(uint8_t _L,  keyType *_keys,  uint32_t keycount, bool _autoclear = true,  void *_values = NULL, size_t _valuesize = 0, int32_t _allowed_conflicts = -1) {
+        printf("%s : Construct Othello3 with %u keys.\n", get_thid().c_str(), keycount);
+        this->L = _L;
+        this->gather = selectOthelloGather(_L);
+        this->autoclear = _autoclear;
+        this->keys = _keys;
+        this->threads = 1;
+        if (_allowed_conflicts < 0) {
+            int hl = 0;
+            while ((1ULL<<hl) < (uint64_t) keycount * keycount) hl++;
+            this->allowed_conflicts = (keycount < 20) ? 0 : hl * 5;
+        }
+        else
+            this->allowed_conflicts = _allowed_conflicts;
+        this->build = this->buildPeeled(_values, keycount, _valuesize);
+        if (this->build) this->buildOverflow(_values, keycount, _valuesize);
+        stringstream ss;
+        if (this->build)
+            ss << "Succ " << human(keycount) <<" Keys, ma/mb/mc = " << human(this->ma) << "/" << human(this->mb) << "/" << human(this->mc) << " L="<<(int) _L <<" After "<<this->trycount << "tries"<< endl;
+        else
+            ss << "Build Fail!" << endl;
+        printf("%s :%s \n", get_thid().c_str(), ss.str().c_str());
+    }
+    //!\brief Construct Othello3 with vectors.
+    template<typename VT>
+    Othello3(uint8_t _L,  vector<keyType> &keys,  vector<VT> &values, bool _autoclear = true, int32_t allowed_conflicts = -1) :
+        Othello3(_L, & (keys[0]),keys.size(), _autoclear, &(values[0]), sizeof(VT), allowed_conflicts)
+    {
+    }
+    //!\brief Construct Othello3 with IOBufs.
+    template<typename VT>
+    Othello3(uint8_t _L,  IOBuf<keyType> &keys,  IOBuf<VT> &values, bool _autoclear = true, int32_t allowed_conflicts = -1) :
+        Othello3(_L, keys.getstart(), keys.size(), _autoclear, values.getstart(), sizeof(VT), allowed_conflicts)
+    {
+    }
+};
+
 /*
 template<size_t L, class valueType>
 
@@ -468,93 +1190,473 @@ std::array<uint8_t,L> operator ^ (const std::array<uint8_t,L>  &A,const std::arr
 
 */
 
+/*!
+ \note The degrees of the nodes are counted in *offsets*, buildGraph() completes the CSR.
+ */
 template< class keyType>
 bool Othello<keyType>::testHash(uint32_t keycount) {
-    uint32_t ha, hb;
-    nxt1  = new vector<int32_t> (keycount);
-    nxt2  = new vector<int32_t> (keycount);
-    first = new vector<int32_t> (ma+mb, -1);
+    const uint32_t W = 64;
+    uint32_t ha[W], hb[W];
+    offsets.assign((uint64_t) ma + mb + 1, 0);
     removedKeys.clear();
+    removedIdx.clear();
     disj.clear();
-    for (uint32_t i = 0; i < keycount; i++) {
-        if ((i&4194303) ==0) if (i)
-                printf("%s: Testing keys # %d\n",get_thid().c_str(), i);
-        get_hash(keys[i], ha, hb);
-
-        if (disj.sameset(ha,hb)) {
-            removedKeys.push_back(keys[i]);
-            if (removedKeys.size()> allowed_conflicts)
-                return false;
-            continue;
-        }
-        (*nxt1)[i] = (*first)[ha];
-        (*first)[ha] = i;
-        (*nxt2)[i] = (*first)[hb];
-        (*first)[hb] = i;
-        disj.merge(ha,hb);
+    for (uint32_t i0 = 0; i0 < keycount; i0 += W) {
+        if ((i0&4194303) ==0) if (i0)
+                printf("%s: Testing keys # %d\n",get_thid().c_str(), i0);
+        uint32_t cnt = (keycount - i0 < W) ? (keycount - i0) : W;
+        get_hash_batch(keys + i0, cnt, ha, hb);
+        for (uint32_t j = 0; j < cnt; j++) {
+            if (disj.sameset(ha[j],hb[j])) {
+                removedKeys.push_back(keys[i0 + j]);
+                removedIdx.push_back(i0 + j);
+                if (removedKeys.size()> allowed_conflicts)
+                    return false;
+                continue;
+            }
+            offsets[ha[j]]++;
+            offsets[hb[j]]++;
+            disj.merge(ha[j],hb[j]);
+        }
     }
     return true;
 }
 
+/*!
+ \brief testHash() with *threads* threads, each inserting a contiguous range of the keys.
+ \note The acyclicity is tested with DisjointSet::mergeConcurrent(). Which key of a cycle is removed depends on the thread timing.
+ */
+template< class keyType>
+bool Othello<keyType>::testHashConcurrent(uint32_t keycount) {
+    offsets.assign((uint64_t) ma + mb + 1, 0);
+    removedKeys.clear();
+    removedIdx.clear();
+    disj.clear();
+    std::atomic<bool> fail(false);
+    std::mutex removedMutex;
+    runThreads(keycount, [&](uint64_t st, uint64_t ed) {
+        const uint32_t W = 64;
+        uint32_t ha[W], hb[W];
+        for (uint64_t i0 = st; i0 < ed && !fail.load(std::memory_order_relaxed); i0 += W) {
+            uint32_t cnt = (ed - i0 < W) ? (ed - i0) : W;
+            get_hash_batch(keys + i0, cnt, ha, hb);
+            for (uint32_t j = 0; j < cnt; j++) {
+                if (!disj.mergeConcurrent(ha[j], hb[j])) {
+                    std::lock_guard<std::mutex> lock(removedMutex);
+                    removedKeys.push_back(keys[i0 + j]);
+                    removedIdx.push_back(i0 + j);
+                    if (removedKeys.size() > allowed_conflicts)
+                        fail = true;
+                    continue;
+                }
+                __atomic_fetch_add(&offsets[ha[j]], 1, __ATOMIC_RELAXED);
+                __atomic_fetch_add(&offsets[hb[j]], 1, __ATOMIC_RELAXED);
+            }
+        }
+    });
+    sort(removedIdx.begin(), removedIdx.end());
+    return !fail;
+}
+
+/*!
+ \brief build the CSR *adj* of the keys kept by testHash().
+ \note The hashes are computed again here in one sequential pass over the keys, and cached in *adj* for fillvalue().
+  The writes to *adj* are independent of each other, unlike the reads during the BFS.
+ */
+template< class keyType>
+void Othello<keyType>::buildGraph(uint32_t keycount) {
+    bool concurrent = (threads > 1);
+    //! offsets[x] is the degree of x, make it the end of the edges of x, and move it back to the start while placing them.
+    for (uint64_t x = 1; x < offsets.size(); x++)
+        offsets[x] += offsets[x-1];
+    adj.resize(offsets.back());
+    runThreads(keycount, [&](uint64_t st, uint64_t ed) {
+        const uint32_t W = 64;
+        uint32_t ha[W], hb[W];
+        auto rm = lower_bound(removedIdx.begin(), removedIdx.end(), st);
+        for (uint64_t i0 = st; i0 < ed; i0 += W) {
+            uint32_t cnt = (ed - i0 < W) ? (ed - i0) : W;
+            get_hash_batch(keys + i0, cnt, ha, hb);
+            for (uint32_t j = 0; j < cnt; j++) {
+                uint32_t i = i0 + j;
+                if (rm != removedIdx.end() && *rm == i) {
+                    rm++;
+                    continue;
+                }
+                AdjEntry ea = {hb[j], i}, eb = {ha[j], i};
+                if (concurrent) {
+                    adj[__atomic_sub_fetch(&offsets[ha[j]], 1, __ATOMIC_RELAXED)] = ea;
+                    adj[__atomic_sub_fetch(&offsets[hb[j]], 1, __ATOMIC_RELAXED)] = eb;
+                }
+                else {
+                    adj[--offsets[ha[j]]] = ea;
+                    adj[--offsets[hb[j]]] = eb;
+                }
+            }
+        }
+    });
+}
+
+/*!
+ \note The BFS queue is a ring buffer in *Q*, which grows only when the frontier exceeds it.
+ */
+template< class keyType>
+template <bool concurrent>
+void Othello<keyType>::fillcomponent(uint32_t root, valueType rootvalue, void *values, size_t valuesize, vector<uint32_t> &Q) {
+    if (Q.size() < 1024) Q.resize(1024);
+    uint64_t cap = Q.size(), qh = 0, qt = 0;
+    auto push = [&](uint32_t x) {
+        if (qt - qh == cap) {
+            vector<uint32_t> nq(cap * 2);
+            for (uint64_t p = qh; p < qt; p++)
+                nq[p - qh] = Q[p & (cap - 1)];
+            Q.swap(nq);
+            qt -= qh;
+            qh = 0;
+            cap *= 2;
+        }
+        Q[(qt++) & (cap - 1)] = x;
+    };
+    push(root);
+    if (concurrent) setConcurrent(root, rootvalue);
+    else set(root, rootvalue);
+    markfilled(root);
+    while (qh < qt) {
+        uint32_t hthis = Q[(qh++) & (cap - 1)];
+        for (uint32_t p = offsets[hthis]; p < offsets[hthis + 1]; p++) {
+            uint32_t kid = adj[p].kid;
+            //! m[hthis] is already filled, now fill m[helse].
+            uint32_t helse = adj[p].node;
+            if (isfilled(helse))
+                continue;
+            valueType valueKid = 0;
+            if (values != NULL) {
+                uint8_t * loc = (uint8_t *) values;
+                loc += (kid * valuesize);
+                memcpy(&valueKid, loc, valuesize);
+            }
+            else {
+                //! when hthis == ha, this is a edge pointing from U to V, i.e., value of this edge shall be set as 1.
+                valueKid = (hthis < ma)?1:0;
+                __atomic_fetch_or(&fillcount[helse/FILLCNTLEN], (1U<<(helse % FILLCNTLEN)), __ATOMIC_RELAXED);
+            }
+            if (concurrent) {
+                valueType newvalue = valueKid ^ getConcurrent(hthis);
+                setConcurrent(helse, newvalue);
+            }
+            else {
+                valueType newvalue = valueKid ^ get(hthis);
+                set(helse, newvalue);
+            }
+            markfilled(helse);
+            __builtin_prefetch(&offsets[helse]);
+            push(helse);
+        }
+    }
+}
+
+/*!
+ \note The connected components are independent, with *threads* > 1 they are filled by all threads,
+  each taking the roots from a shared counter in blocks. Cells of no key are left 0 either way.
+ */
 template< class keyType>
 void Othello<keyType>::fillvalue(void *values, /*uint32_t keycount,*/ size_t valuesize) {
-    list<uint32_t> Q;
-    vector<int32_t> *nxt;
-    filled.resize(ma+mb);
-    fill(filled.begin(), filled.end(), false);
+    filled.assign(((uint64_t) ma + mb + 63) / 64, 0);
     if (values == NULL) {
-        fillcount.resize((ma+mb)/32);
+        fillcount.resize((ma+mb+31)/32);
         fill(fillcount.begin(),fillcount.end(),0);
     }
-    for (unsigned int i = 0; i< ma+mb; i++)
-        if (disj.isroot(i)) {
-            while (!Q.empty()) Q.pop_front();
-            Q.push_back(i);
-            valueType vv;
-            getrand(vv);
-            set(i,vv);
-            filled[i] = true;
-            while (!Q.empty()) {
-                uint32_t nodeid = (*Q.begin());
-                Q.pop_front();
-                if (nodeid < ma) nxt = nxt1;
-                else nxt = nxt2;
-                int32_t kid = first->at(nodeid);
-                while (kid >=0) {
-                    uint32_t ha,hb;
-                    get_hash(keys[kid],ha,hb);
-                    if (filled[ha] && filled[hb]) {
-                        kid = nxt->at(kid);
-                        continue;
-                    }
-                    unsigned int helse = filled[ha] ? hb : ha;
-                    unsigned int hthis = filled[ha] ? ha : hb;
-                    //! m[hthis] is already filled, now fill m[helse].
-                    valueType valueKid = 0;
-                    if (values != NULL) {
-                        uint8_t * loc = (uint8_t *) values;
-                        loc += (kid * valuesize);
-                        memcpy(&valueKid, loc, valuesize);
-                    }
-//                        valueKid = values[kid];
-                    else {
-                        //! when hthis == ha, this is a edge pointing from U to V, i.e., value of this edge shall be set as 1.
-                        valueKid = (hthis == ha)?1:0;
-                        fillcount[helse/FILLCNTLEN] |= (1<<(helse % FILLCNTLEN));
-                    }
+    if (threads <= 1) {
+        vector<uint32_t> Q;
+        //! any node of a component can be its root.
+        for (unsigned int i = 0; i< ma+mb; i++)
+            if (offsets[i+1] > offsets[i] && !isfilled(i)) {
+                valueType vv;
+                getrand(vv);
+                fillcomponent<false>(i, vv, values, valuesize, Q);
+            }
+        return;
+    }
+    const uint32_t BLOCK = 65536;
+    std::atomic<uint64_t> nextblock(0);
+    vector<uint64_t> seeds(threads);
+    for (auto &x : seeds)
+        getrand(x);
+    auto worker = [&](uint32_t t) {
+        std::mt19937_64 gen(seeds[t]);
+        vector<uint32_t> Q;
+        uint64_t st;
+        while ((st = nextblock.fetch_add(BLOCK)) < (uint64_t) ma + mb) {
+            uint64_t ed = (st + BLOCK < (uint64_t) ma + mb) ? st + BLOCK : (uint64_t) ma + mb;
+            for (uint64_t i = st; i < ed; i++)
+                if (offsets[i+1] > offsets[i] && disj.isroot(i))
+                    fillcomponent<true>(i, gen(), values, valuesize, Q);
+        }
+    };
+    vector<thread> vth;
+    for (uint32_t t = 0; t < threads; t++)
+        vth.push_back(thread(worker, t));
+    for (auto &th : vth)
+        th.join();
+}
 
-                    valueType newvalue = valueKid ^ get(hthis);
-//                    printf("%x %x %x===", valueKid, get(hthis), newvalue);
-                    set(helse, newvalue);
-//                    printf("k%llx ha/hb %lx %lx: %x ^ %x = %x ^ %x = %x (%x), helse%x ,i%x, %d\n",
-//                       keys[kid], ha, hb, get(hthis) & LMASK, newvalue & LMASK, get(ha) &LMASK, get(hb) &LMASK, (get(ha)^get(hb)) & LMASK, valueKid &LMASK, helse ,hthis ,(bool)((valueKid &LMASK)==((get(ha)^(get(hb)))&LMASK)));
-                    Q.push_back(helse);
-                    filled[helse] = true;
-                    kid = nxt->at(kid);
-                }
+/*!
+ \brief build the blocked layout, the number of blocks grows by 10% until every block is built.
+ */
+template< class keyType>
+bool Othello<keyType>::buildBlocked(void *values, uint32_t keycount, size_t valuesize, uint32_t _blockbytes) {
+    if (values == NULL && keycount > 0)
+        throw std::invalid_argument("the blocked Othello layout needs the values of the keys");
+    setBlockLayout(_blockbytes, 1);
+    uint64_t nb = keycount / (BLOCK_LOAD * (blockA + blockB)) + 1;
+    trycount = 0;
+    while (nb < (1ULL << 32)) {
+        setBlockLayout(_blockbytes, nb);
+        mem.resize(memSize());
+        newHash();
+        if (trybuildBlocked(values, keycount, valuesize))
+            return true;
+        nb = nb + nb / 10 + 1;
+        printf("%s : Extend Othello to %u blocks of %u bytes\n", get_thid().c_str(), (uint32_t) nb, blockbytes);
+    }
+    return false;
+}
+
+/*!
+ \brief build the three-hash layout, starting from PEEL_LOAD * keycount cells.
+  After MAX_REHASH failed tries, the arrays grow by about 8%.
+ */
+template< class keyType>
+bool Othello<keyType>::buildPeeled(void *values, uint32_t keycount, size_t valuesize) {
+    if (values == NULL && keycount > 0)
+        throw std::invalid_argument("the three-hash Othello layout needs the values of the keys");
+    uint64_t seg = ((uint64_t) (keycount * PEEL_LOAD) + 32 + 2) / 3;
+    while (seg * 3 < (1ULL << 32)) {
+        ma = mb = mc = seg;
+        mem.resize(memSize());
+        trycount = 0;
+        while (trycount < MAX_REHASH) {
+            newHash();
+            if (trybuildPeeled(values, keycount, valuesize))
+                return true;
+        }
+        seg += seg / 12 + 1;
+        printf("%s : Extend Othello to 3 x %s cells\n", get_thid().c_str(), human(seg).c_str());
+    }
+    return false;
+}
+
+/*!
+ \brief build the three-hash layout by peeling the hypergraph whose edges are the keys, each on its cells at Ha, Hb and Hc.
+ \note A cell with only one key left is peeled, i.e., its key is pushed on a stack and removed from its other cells.
+  The cells are then set in the reverse order, so that the cell of each key is set after the other two cells of this key.
+  The keys left in the 2-core are removed, within *allowed_conflicts*.
+  A cell stores the xor of the indices of its keys, so that the key of a cell of degree 1 is known without an adjacency list.
+ */
+template< class keyType>
+bool Othello<keyType>::trybuildPeeled(void *values, uint32_t keycount, size_t valuesize) {
+    const uint64_t m = (uint64_t) ma + mb + mc;
+    vector<uint32_t> deg(m, 0), xorkid(m, 0);
+    for (uint32_t i0 = 0; i0 < keycount; i0 += QUERY_WINDOW) {
+        uint32_t ha[QUERY_WINDOW], hb[QUERY_WINDOW], hc[QUERY_WINDOW];
+        uint32_t cnt = (keycount - i0 < QUERY_WINDOW) ? (keycount - i0) : QUERY_WINDOW;
+        get_hash3_batch(keys + i0, cnt, ha, hb, hc);
+        for (uint32_t j = 0; j < cnt; j++) {
+            deg[ha[j]]++;
+            deg[hb[j]]++;
+            deg[hc[j]]++;
+            xorkid[ha[j]] ^= i0 + j;
+            xorkid[hb[j]] ^= i0 + j;
+            xorkid[hc[j]] ^= i0 + j;
+        }
+    }
+    auto cellsOf = [&](uint32_t kid, uint32_t *c) {
+        c[0] = Ha(keys[kid]);
+        c[1] = ma + Hb(keys[kid]);
+        c[2] = ma + mb + Hc(keys[kid]);
+    };
+    struct Peeled {
+        uint32_t kid, cell;
+    };
+    vector<Peeled> stack;
+    stack.reserve(keycount);
+    vector<uint32_t> Q;
+    for (uint64_t x = 0; x < m; x++)
+        if (deg[x] == 1) Q.push_back(x);
+    for (size_t qh = 0; qh < Q.size(); qh++) {
+        uint32_t x = Q[qh];
+        if (deg[x] != 1) continue;
+        uint32_t kid = xorkid[x], c[3];
+        stack.push_back({kid, x});
+        cellsOf(kid, c);
+        for (uint32_t y : c) {
+            deg[y]--;
+            xorkid[y] ^= kid;
+            if (deg[y] == 1) Q.push_back(y);
+        }
+    }
+    Q.clear();
+    Q.shrink_to_fit();
+    xorkid.clear();
+    xorkid.shrink_to_fit();
+    removedKeys.clear();
+    if (keycount - stack.size() > allowed_conflicts)
+        return false;
+    if (stack.size() < keycount) {
+        vector<bool> peeled(keycount, false);
+        for (auto &p : stack) peeled[p.kid] = true;
+        for (uint32_t i = 0; i < keycount; i++)
+            if (!peeled[i]) {
+                removedKeys.push_back(keys[i]);
+                printf("%s: Conflict key %lx, removed\n", get_thid().c_str(), (uint64_t) keys[i]);
+            }
+    }
+    deg.clear();
+    deg.shrink_to_fit();
+    mem.resize(memSize());
+    for (size_t i = stack.size(); i-- > 0; ) {
+        uint32_t c[3];
+        cellsOf(stack[i].kid, c);
+        valueType valueKid = 0;
+        memcpy(&valueKid, ((uint8_t *) values) + ((uint64_t) stack[i].kid) * valuesize, valuesize);
+        //! the cell being set is still 0.
+        valueKid ^= get(c[0]) ^ get(c[1]) ^ get(c[2]);
+        othelloSetCell(mem.data(), L, stack[i].cell, valueKid & LMASK);
+    }
+    return true;
+}
+
+/*!
+ \brief bucket the keys by block, then build each block independently, using *threads* threads.
+ \note For a block, the seeds 0..2^BLOCK_SEED_BITS-1 are tried until the cells of its keys form an acyclic graph.
+  If none does, the seed with the fewest cycles is used and the keys closing the cycles are removed, within *allowed_conflicts*.
+ */
+template< class keyType>
+bool Othello<keyType>::trybuildBlocked(void *values, uint32_t keycount, size_t valuesize) {
+    struct BlockKey {
+        uint32_t ha, hb, kid;
+    };
+    vector<uint32_t> bstart((uint64_t) nblocks + 1, 0);
+    vector<BlockKey> bkeys(keycount);
+    for (uint32_t i0 = 0; i0 < keycount; i0 += QUERY_WINDOW) {
+        uint32_t ha[QUERY_WINDOW];
+        uint32_t cnt = (keycount - i0 < QUERY_WINDOW) ? (keycount - i0) : QUERY_WINDOW;
+        Ha.hashBatch(keys + i0, cnt, ha);
+        for (uint32_t j = 0; j < cnt; j++)
+            bstart[blockOf(ha[j]) + 1]++;
+    }
+    for (uint64_t b = 0; b < nblocks; b++)
+        bstart[b + 1] += bstart[b];
+    vector<uint32_t> cur(bstart.begin(), bstart.end() - 1);
+    for (uint32_t i0 = 0; i0 < keycount; i0 += QUERY_WINDOW) {
+        uint32_t ha[QUERY_WINDOW], hb[QUERY_WINDOW];
+        uint32_t cnt = (keycount - i0 < QUERY_WINDOW) ? (keycount - i0) : QUERY_WINDOW;
+        Ha.hashBatch(keys + i0, cnt, ha);
+        Hb.hashBatch(keys + i0, cnt, hb);
+        for (uint32_t j = 0; j < cnt; j++)
+            bkeys[cur[blockOf(ha[j])]++] = {ha[j], hb[j], i0 + j};
+    }
+    cur.clear();
+    cur.shrink_to_fit();
 
+    removedKeys.clear();
+    std::atomic<bool> fail(false);
+    std::atomic<uint32_t> removedCount(0);
+    std::mutex removedMutex;
+    valueType seed;
+    getrand(seed);
+    const uint32_t cells = blockA + blockB;
+    const uint32_t W = blockbytes / 8;
+    runThreads(nblocks, [&](uint64_t st, uint64_t ed) {
+        std::mt19937_64 gen(seed + st);
+        vector<uint32_t> fa(cells), ca, cb, deg(cells + 1), adjk(0), Q(cells);
+        vector<bool> keep, filledcell(cells);
+        auto getfa = [&](uint32_t x) {
+            while (fa[x] != x) x = fa[x] = fa[fa[x]];
+            return x;
+        };
+        //! the number of keys closing a cycle with seed t, stops early at *limit*.
+        auto countConflicts = [&](uint32_t b, uint32_t t, uint32_t limit) {
+            for (uint32_t x = 0; x < cells; x++) fa[x] = x;
+            uint32_t conf = 0;
+            for (uint32_t p = bstart[b]; p < bstart[b + 1] && conf < limit; p++) {
+                uint32_t a, c;
+                blockCells(bkeys[p].ha, bkeys[p].hb, t, a, c);
+                uint32_t ra = getfa(a), rc = getfa(c);
+                if (ra == rc) conf++;
+                else fa[ra] = rc;
+            }
+            return conf;
+        };
+        for (uint64_t b = st; b < ed && !fail.load(std::memory_order_relaxed); b++) {
+            uint32_t n = bstart[b + 1] - bstart[b];
+            uint32_t bestT = 0, bestConf = countConflicts(b, 0, UINT32_MAX);
+            for (uint32_t t = 1; t < (1U << BLOCK_SEED_BITS) && bestConf; t++) {
+                uint32_t conf = countConflicts(b, t, bestConf);
+                if (conf < bestConf) {
+                    bestConf = conf;
+                    bestT = t;
+                }
+            }
+            if (bestConf && removedCount.fetch_add(bestConf) + bestConf > allowed_conflicts) {
+                fail = true;
+                break;
             }
+            //! the edges kept with seed bestT, in CSR over the cells of this block.
+            ca.resize(n);
+            cb.resize(n);
+            keep.assign(n, true);
+            fill(deg.begin(), deg.end(), 0);
+            for (uint32_t x = 0; x < cells; x++) fa[x] = x;
+            for (uint32_t j = 0; j < n; j++) {
+                const BlockKey &e = bkeys[bstart[b] + j];
+                blockCells(e.ha, e.hb, bestT, ca[j], cb[j]);
+                uint32_t ra = getfa(ca[j]), rc = getfa(cb[j]);
+                if (ra == rc) {
+                    keep[j] = false;
+                    std::lock_guard<std::mutex> lock(removedMutex);
+                    removedKeys.push_back(keys[e.kid]);
+                    continue;
+                }
+                fa[ra] = rc;
+                deg[ca[j] + 1]++;
+                deg[cb[j] + 1]++;
+            }
+            for (uint32_t x = 0; x < cells; x++)
+                deg[x + 1] += deg[x];
+            adjk.resize(deg[cells]);
+            vector<uint32_t> pos(deg.begin(), deg.end() - 1);
+            for (uint32_t j = 0; j < n; j++)
+                if (keep[j]) {
+                    adjk[pos[ca[j]]++] = j;
+                    adjk[pos[cb[j]]++] = j;
+                }
+            valueType *blk = &mem[b * W];
+            filledcell.assign(cells, false);
+            for (uint32_t root = 0; root < cells; root++) {
+                if (filledcell[root] || deg[root + 1] == deg[root]) continue;
+                othelloSetCell(blk, L, root, gen() & LMASK);
+                filledcell[root] = true;
+                uint32_t qh = 0, qt = 0;
+                Q[qt++] = root;
+                while (qh < qt) {
+                    uint32_t u = Q[qh++];
+                    for (uint32_t p = deg[u]; p < deg[u + 1]; p++) {
+                        uint32_t j = adjk[p];
+                        uint32_t w = ca[j] ^ cb[j] ^ u;
+                        if (filledcell[w]) continue;
+                        valueType valueKid = 0;
+                        memcpy(&valueKid, ((uint8_t *) values) + ((uint64_t) bkeys[bstart[b] + j].kid) * valuesize, valuesize);
+                        othelloSetCell(blk, L, w, (valueKid ^ othelloCell(blk, L, u)) & LMASK);
+                        filledcell[w] = true;
+                        Q[qt++] = w;
+                    }
+                }
+            }
+            blk[W - 1] |= ((uint64_t) bestT) << (64 - BLOCK_SEED_BITS);
         }
+    });
+    return !fail;
 }
 
 template< class keyType>
@@ -603,12 +1705,12 @@ vector<double> Othello<keyType>::getRatio() {
 
 template< class keyType>
 void Othello<keyType>::randomflip() {
-    if (filled.size() <=1) return;
+    if (filled.empty()) return;
     printf("Random flip\n");
     valueType vv;
     vector<list<uint32_t> > VL(ma+mb, list<uint32_t>());
     for (int i = 0; i< ma+mb; i++)
-        if (!filled[i]) {
+        if (!isfilled(i)) {
             valueType vv;
             getrand(vv);
             set(i,vv);
@@ -648,12 +1750,12 @@ void Othello<keyType>::setAlienPreference(double ideal) {
     //for (int j =0; j <L; j++) na[j]=nb[j] =0;
     int emptyA = 0;
     int emptyB = 0;
-    if (filled.size() <=1) return;
+    if (filled.empty()) return;
     printf("Adjust bitmap goal: return 1 with rate %.3lf\n",ideal);
     valueType vv;
     vector<list<uint32_t> > VL(ma+mb, list<uint32_t>());
     for (int i = 0; i< ma+mb; i++) {
-        if (!filled[i]) {
+        if (!isfilled(i)) {
             valueType vv;
             if (i<ma) emptyA++;
             else emptyB++;
@@ -701,9 +1803,9 @@ void Othello<keyType>::setAlienPreference(double ideal) {
         veA |= ((direction[bitID] & 8) ? (1<<bitID) : 0);
         veB |= ((direction[bitID] & 16) ? (1<<bitID) : 0);
     }
-    for (int i = 0; i < ma; i++) if (!filled[i])
+    for (int i = 0; i < ma; i++) if (!isfilled(i))
             set(i,veA);
-    for (int i = ma; i <ma+mb; i++) if (!filled[i])
+    for (int i = ma; i <ma+mb; i++) if (!isfilled(i))
             set(i,veB);
 
     for (int i = 0; i < ma+mb; i++) {
@@ -734,11 +1836,21 @@ void Othello<keyType>::getrates(map<int, double> &sum) {
     map<int,long long> sumint;
     int high =  (1<<L);
     vector<long long> LA(high), LB(high);
+    if (blockbytes) {
+        for (uint64_t b = 0; b < nblocks; b++) {
+            const valueType *blk = mem.data() + b * (blockbytes / 8);
+            for (uint32_t c = 0; c < blockA; c++)
+                LA[othelloCell(blk, L, c) & (high-1)]++;
+            for (uint32_t c = blockA; c < blockA + blockB; c++)
+                LB[othelloCell(blk, L, c) & (high-1)]++;
+        }
+    }
+    //! in the three-hash layout, the xor of arrayB and arrayC is sampled by pairing their cells.
     for (unsigned int i = 0 ; i < ma; i++)
         LA[get(i) & (high-1) ]++;
     for (unsigned int i = ma; i<ma+mb; i++)
-        LB[get(i) & (high-1) ]++;
-    int suma = 0, sumb=0;
+        LB[(get(i) ^ (mc ? get(i + mb) : 0)) & (high-1) ]++;
+    long long suma = 0, sumb=0;
     for (auto &x: LA) suma += x;
     for (auto &x: LB) sumb+= x;
     //printf("%d %d\n", suma, sumb);
@@ -754,8 +1866,8 @@ void Othello<keyType>::getrates(map<int, double> &sum) {
         long long tot = 0;
         for (int i = 0 ; i < high; i++)
             tot += ((long long) LA[i])*LB[i];
-        long long rest = ma;
-        rest *= mb;
+        long long rest = suma;
+        rest *= sumb;
         rest -= tot;
         rest/=(high-1);
         sumint[0] = tot;
@@ -764,6 +1876,6 @@ void Othello<keyType>::getrates(map<int, double> &sum) {
         //printf("%lld + %lld + %lld \n", tot, rest, high);
     }
     for (auto &x: sumint) {
-        sum[x.first]=((double ) 1.0 * x.second)/((long long) ma* (long long)mb);
+        sum[x.first]=((double ) 1.0 * x.second)/(suma * sumb);
     }
 }
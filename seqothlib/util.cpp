@@ -5,6 +5,11 @@
 #include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
 
 //! split a c-style string with delimineter chara.
@@ -47,3 +52,62 @@ std::string get_thid() {
     ss >> s;
     return s;
 }
+
+static thread_local int pinnedNumaNode = -1;
+
+//! read a list of ranges as in /sys/devices/system/node, e.g., "0-3,8-11".
+static std::vector<int> readNodeList(const std::string &fname) {
+    std::vector<int> ret;
+    std::ifstream fin(fname);
+    std::string line;
+    if (!std::getline(fin, line))
+        return ret;
+    for (auto &range : split(line.c_str(), ',')) {
+        int lo = 0, hi = 0;
+        int cnt = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+        if (cnt < 1) continue;
+        if (cnt == 1) hi = lo;
+        for (int i = lo; i <= hi; i++)
+            ret.push_back(i);
+    }
+    return ret;
+}
+
+std::vector<int> numaNodesWithCPUs() {
+    // the ids may be sparse, and memory-only nodes, e.g., of HBM or CXL memory, have no CPUs to pin threads to.
+    auto online = readNodeList("/sys/devices/system/node/online");
+    auto cpus = readNodeList("/sys/devices/system/node/has_cpu");
+    std::vector<int> nodes;
+    for (int n : online)
+        if (std::find(cpus.begin(), cpus.end(), n) != cpus.end())
+            nodes.push_back(n);
+    if (nodes.empty())
+        nodes.push_back(0);
+    return nodes;
+}
+
+int currentNumaNode() {
+    if (pinnedNumaNode >= 0)
+        return pinnedNumaNode;
+    // an unpinned thread asks once, and keeps the node it first ran on.
+    unsigned int cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        node = 0;
+    pinnedNumaNode = node;
+    return node;
+}
+
+bool pinToNumaNode(int node) {
+    auto cpus = readNodeList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    if (cpus.empty())
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        if (c < CPU_SETSIZE)
+            CPU_SET(c, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        return false;
+    pinnedNumaNode = node;
+    return true;
+}
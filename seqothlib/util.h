@@ -11,3 +11,10 @@ std::vector<std::string> split(const char * str, char deli);
 void printcurrtime();
 
 std::string get_thid();
+
+//! \brief the online NUMA nodes that have CPUs, {0} if they are unknown.
+std::vector<int> numaNodesWithCPUs();
+//! \brief the NUMA node the calling thread is pinned to by pinToNumaNode(), or otherwise the node it first ran on.
+int currentNumaNode();
+//! \brief restrict the calling thread to the CPUs of NUMA node *node*.
+bool pinToNumaNode(int node);
@@ -24,8 +24,15 @@ int main(int argc, char ** argv) {
     args::ValueFlag<string> argInputname(parser, "string", "The file list containing the names of Group files created by the Group function.", {"flist"});
     args::ValueFlag<string> argFolder(parser, "string", "The directory to the Group files.", {"folder","grp-folder"});
     args::ValueFlag<string> argOutputname(parser, "string", "The directory to the SeqOthello map.", {"out-folder"});
-    //args::ValueFlag<int> argThread(parser, "int", "number of parallel threads to build SeqOthello", {"thread"});
+    args::ValueFlag<int> argThread(parser, "int", "number of parallel threads to build SeqOthello. Default 1.", {"thread"});
     args::ValueFlag<int> argLimit(parser, "int", "Nuumber of kmers used to estimate the distribution. Default 10485760.", {"estimate-limit"});
+    args::ValueFlag<int> argL1Block(parser, "int", "Block size in bytes of the blocked Othello layout for the L1 node: 0 (classic, default), 64 or 4096.", {"l1-block"});
+    args::ValueFlag<int> argL2Block(parser, "int", "Block size in bytes of the blocked Othello layout for the L2 nodes: 0 (classic, default), 64 or 4096.", {"l2-block"});
+    args::ValueFlag<int> argL1Hashes(parser, "int", "Number of hash functions of the Othellos of the L1 node: 2 (default) or 3. 3 uses less memory, and can not be used with --l1-block.", {"l1-hashes"});
+    args::ValueFlag<int> argL2Hashes(parser, "int", "Number of hash functions of the Othellos of the L2 nodes: 2 (default) or 3. 3 uses less memory, and can not be used with --l2-block.", {"l2-hashes"});
+    args::ValueFlag<int> argL1Memory(parser, "int", "Estimated memory in MB used to build the L1 node in parallel. Default: enough for 512M keys.", {"l1-memory-mb"});
+    args::Flag argL1Balanced(parser, "l1-balanced", "Split the L1 node into parts of the same number of keys, instead of by the highest bits of the keys. Older versions can not query such a map.", {"l1-balanced"});
+    args::ValueFlag<int> argStageMB(parser, "int", "Memory in MB to keep the keys and values of the nodes before they are built, the rest is written to temporary files in the background. Default 1024.", {"stage-mb"});
     args::Flag argCountOnly(parser, "count-only", "Only count the keys and the histogram, do not build the seqOthello.", {"count-only"});
     //args::ValueFlag<int> argEXP(parser, "int", "Expression bits, optional: None, 1, 2, 4", {"exp"});
 
@@ -56,8 +63,8 @@ int main(int argc, char ** argv) {
         return 1;
     }
     int nThreads = 1;
-    //if (argThread)
-    //    nThreads = args::get(argThread);
+    if (argThread)
+        nThreads = args::get(argThread);
     vector<uint64_t> keyHisto, encodeHisto;
 
     string prefix = "";
@@ -143,6 +150,34 @@ int main(int argc, char ** argv) {
     reader->reset();
 //    auto reader = make_shared<GrpReader<uint64_t>> (args::get(argInputname), args::get(argFolder));
     auto seqoth = make_shared<SeqOthello> ();
+    for (auto *arg : {&argL1Block, &argL2Block})
+        if (*arg && args::get(*arg) != 0 && args::get(*arg) != 64 && args::get(*arg) != 4096) {
+            std::cerr << "Block size must be 0, 64 or 4096." << std::endl;
+            return 1;
+        }
+    if (argL1Block)
+        seqoth->l1BlockBytes = args::get(argL1Block);
+    if (argL2Block)
+        seqoth->l2BlockBytes = args::get(argL2Block);
+    for (auto *arg : {&argL1Hashes, &argL2Hashes})
+        if (*arg && args::get(*arg) != 2 && args::get(*arg) != 3) {
+            std::cerr << "Number of hash functions must be 2 or 3." << std::endl;
+            return 1;
+        }
+    if (argL1Hashes)
+        seqoth->l1Hashes = args::get(argL1Hashes);
+    if (argL2Hashes)
+        seqoth->l2Hashes = args::get(argL2Hashes);
+    if (argStageMB)
+        IOBufStager::get().budget = ((uint64_t) args::get(argStageMB)) << 20;
+    if (argL1Balanced)
+        seqoth->l1Balanced = true;
+    if (argL1Memory)
+        seqoth->l1BuildMemoryBytes = ((uint64_t) args::get(argL1Memory)) << 20;
+    if ((seqoth->l1Hashes == 3 && seqoth->l1BlockBytes) || (seqoth->l2Hashes == 3 && seqoth->l2BlockBytes)) {
+        std::cerr << "The three-hash Othello can not be blocked." << std::endl;
+        return 1;
+    }
 
     seqoth->constructFromReader(reader.get(), args::get(argOutputname), nThreads, distr, keycount);
     return 0;
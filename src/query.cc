@@ -21,6 +21,8 @@
 using namespace std;
 
 int nqueryThreads = 1;
+vector<int> numaNodes; //!< if more than 1, the server threads are pinned to these NUMA nodes in turn.
+std::atomic<int> nextNumaNode(0);
 
 struct ThreadParameter {
     TCPSocket * sock;
@@ -41,18 +43,20 @@ int queryL2ShowSampleonly(int i, const shared_ptr<SeqOthello> seqoth,
     L2Node*  pvNode = (seqoth->vNodes[i]).get();
     printf("L2 got %lu kmers -- try to get sample index %d.\n", kmers.size(), showSampleIndex);
     unordered_map<int, vector<int>> mans;
+    vector<uint64_t> index(kmers.size());
+    pvNode->queryIndexBatch(&kmers[0], kmers.size(), &index[0]);
+    vector<uint32_t> ret;
+    vector<uint8_t> retmap;
     for (unsigned int j = 0 ; j < kmers.size(); j++) {
-        auto kmer = kmers[j];
         auto TID = TIDs[j];
-        vector<uint32_t> ret;
-        vector<uint8_t> retmap;
-        bool respond = pvNode->smartQuery(&kmer, ret, retmap);
-        if (respond) {
-            if (find(ret.begin(), ret.end(), showSampleIndex)!=ret.end())
+        const uint8_t *bitmap = pvNode->bitmapByIndex(index[j]);
+        if (bitmap) {
+            if (bitmap[showSampleIndex >> 3] &( 1<< ( showSampleIndex &7)))
                 mans[TID].push_back(PosInTranscript[j]);
         }
         else {
-            if (retmap[showSampleIndex >> 3] &( 1<< ( showSampleIndex &7)))
+            pvNode->queryByIndex(index[j], ret, retmap);
+            if (find(ret.begin(), ret.end(), showSampleIndex)!=ret.end())
                 mans[TID].push_back(PosInTranscript[j]);
         }
     }
@@ -76,7 +80,8 @@ int queryL2InThreadPool(int i, const shared_ptr<SeqOthello> seqoth,
                         const vector<uint32_t> &TIDs,
                         const vector<uint32_t> &PosInTranscript,
                         vector<vector<shared_ptr<string>>> &detailans,
-                        map<int, vector<int> *> &ans,
+                        vector<int> &ans,
+                        unsigned int ansStride,
                         bool argShowDedatils,
                         unsigned int high,
                         std::mutex &mu
@@ -86,51 +91,47 @@ int queryL2InThreadPool(int i, const shared_ptr<SeqOthello> seqoth,
     seqoth->loadL2Node(i);
     if (!seqoth->vNodes[i]) return 0;
 
-    map<int, vector<int> > mans;
     map<pair<int,int>, string> mstr;
     L2Node*  pvNode = (seqoth->vNodes[i]).get();
 //            int high = seqoth->sampleCount;
     printf("L2 got %lu kmers.\n", kmers.size());
-    for (unsigned int j = 0 ; j < kmers.size(); j++) {
-        auto kmer = kmers[j];
-        auto TID = TIDs[j];
+    vector<uint64_t> index(kmers.size());
+    pvNode->queryIndexBatch(&kmers[0], kmers.size(), &index[0]);
+    //! the TIDs are increasing, the hits of the k-mers of rowTID[r] are counted in counts[r*high ...].
+    vector<uint32_t> rowTID;
+    vector<int> counts;
+    if (argShowDedatils) {
         vector<uint32_t> ret;
         vector<uint8_t> retmap;
-        bool respond = pvNode->smartQuery(&kmer, ret, retmap);
-        if (mans.count(TID) == 0) {
-            vector<int> empty(high+1);
-            mans.emplace(TID, empty);
-        }
-        if (argShowDedatils) {
+        for (unsigned int j = 0 ; j < kmers.size(); j++) {
+            auto TID = TIDs[j];
             string str(high,'.');
-            if (respond) {
-                for (auto &p : ret)
-                    if (p<high)
-                        str[p]='+';
-            }
-            else {
-                auto vec = mans.at(TID);
+            const uint8_t *bitmap = pvNode->bitmapByIndex(index[j]);
+            if (bitmap) {
                 for (uint32_t v = 0; v< high; v++) { //ONLY EXP =1...
-                    if (retmap[v>>3] & ( 1<< (v & 7)))
+                    if (bitmap[v>>3] & ( 1<< (v & 7)))
                         str[v] = '+';
                 }
             }
-            mstr[make_pair(TID,PosInTranscript[j])] = str;
-        }
-        else {
-            if (respond) {
-                auto &vec = mans.at(TID);
-                for (auto &p : ret)
-                    if (p<=high)
-                        vec[p] ++;
-            }
             else {
-                auto &vec = mans.at(TID);
-                for (uint32_t v = 0; v< high; v++) { //ONLY EXP =1...
-                    if (retmap[v>>3] & ( 1<< (v & 7)))
-                        vec[v]++;
-                }
+                pvNode->queryByIndex(index[j], ret, retmap);
+                for (auto &p : ret)
+                    if (p<high)
+                        str[p]='+';
             }
+            mstr[make_pair(TID,PosInTranscript[j])] = str;
+        }
+    }
+    else {
+        for (auto TID : TIDs)
+            if (rowTID.empty() || rowTID.back() != TID)
+                rowTID.push_back(TID);
+        counts.resize(rowTID.size() * high);
+        unsigned int r = 0;
+        for (unsigned int j = 0 ; j < kmers.size(); j++) {
+            if (TIDs[j] != rowTID[r])
+                r++;
+            pvNode->countByIndex(index[j], &counts[(size_t) r * high], high);
         }
     }
     seqoth->releaseL2Node(i);
@@ -143,18 +144,11 @@ int queryL2InThreadPool(int i, const shared_ptr<SeqOthello> seqoth,
             }
         }
         else {
-            for (auto &x: mans) {
-                if (ans.count(x.first) == 0)
-                    ans[x.first] = new vector<int>(x.second);
-                else {
-                    auto ip = ans[x.first]->begin();
-                    auto iq = x.second.begin();
-                    while (iq != x.second.end()) {
-                        *ip  += *iq;
-                        ip++;
-                        iq++;
-                    }
-                }
+            for (unsigned int r = 0; r < rowTID.size(); r++) {
+                int *row = &ans[(size_t) rowTID[r] * ansStride];
+                const int *cnt = &counts[(size_t) r * high];
+                for (unsigned int s = 0; s < high && s < ansStride; s++)
+                    row[s] += cnt[s];
             }
         }
     }
@@ -204,28 +198,36 @@ void process(const string &type, ThreadParameter *par) {
         requests.push_back(key);
     }
 
+    vector<uint64_t> l1values(requests.size());
+    par->oth->queryL1Batch(requests.data(), requests.size(), l1values.data());
     auto  itUsedrevse = usedreverse.begin();
-    for (auto k : requests) {
+    auto  itL1value = l1values.begin();
+    if (query_type == CONTAINMENT) {
+        for (unsigned int i = 0; i < requests.size(); i++)
+            par->oth->countWithL1Value(&requests[i], l1values[i], &queryans[0], queryans.size());
+    }
+    else {
         vector<uint32_t> vret;
         vector<uint8_t> vmap;
-        memset(ans,'x',sizeof(ans));
-        auto toconvert = k;
-        if (*itUsedrevse)
-            toconvert = helper.reverseComplement(k);
-        itUsedrevse++;
-        helper.convertstring(ans,&toconvert);
-        char *p = & ans[kmerLength];
-        *p = ' ';
-        p++;
-        bool res = par->oth->smartQuery(&k, vret, vmap);
-        if (!res) {
-            vret.clear();
-            for (unsigned int v = 0; v< par->oth->sampleCount; v++) {
-                if (vmap[v>>3] & ( 1<< (v & 7)))
-                    vret.push_back(v);
+        for (auto k : requests) {
+            memset(ans,'x',sizeof(ans));
+            auto toconvert = k;
+            if (*itUsedrevse)
+                toconvert = helper.reverseComplement(k);
+            itUsedrevse++;
+            helper.convertstring(ans,&toconvert);
+            char *p = & ans[kmerLength];
+            *p = ' ';
+            p++;
+            bool res = par->oth->queryWithL1Value(&k, *itL1value, vret, vmap);
+            itL1value++;
+            if (!res) {
+                vret.clear();
+                for (unsigned int v = 0; v< par->oth->sampleCount; v++) {
+                    if (vmap[v>>3] & ( 1<< (v & 7)))
+                        vret.push_back(v);
+                }
             }
-        }
-        if (query_type == COVERAGE) {
             set<uint16_t> vset(vret.begin(), vret.end());
             for (unsigned int i = 0; i < par->oth->sampleCount; i++) {
                 if (vset.count(i)) *p = '+';
@@ -235,10 +237,6 @@ void process(const string &type, ThreadParameter *par) {
             *p ='\0';
             par->sock->sendmsg(ans, strlen(ans));
         }
-        else {
-            for (auto x: vret) if (x<queryans.size())
-                    queryans[x] ++;
-        }
     }
     if (query_type == CONTAINMENT) {
         stringstream ss;
@@ -287,6 +285,8 @@ void HandleTCPClient(ThreadParameter *par) {
 void *ServerThreadMain(void *par) {
     // Guarantees that thread resources are deallocated upon return
     pthread_detach(pthread_self());
+    if (numaNodes.size() > 1)
+        pinToNumaNode(numaNodes[nextNumaNode++ % numaNodes.size()]);
 
     // Extract socket file descriptor from argument
     HandleTCPClient((ThreadParameter *) par);
@@ -306,6 +306,11 @@ int main(int argc, char ** argv) {
     args::ValueFlag<int>  argNQueryThreads(parser, "int", "how many threads to use for query, default = 1.", {"qthread"});
 
     args::ValueFlag<int>  argStartServer(parser, "int", "start a SeqOthello Server at port.", {"start-server-port"});
+    args::ValueFlag<string> argL1CacheDir(parser, "string", "Directory, e.g. under /dev/shm, where compressed L1 parts are inflated once and then mapped by later queries.", {"l1-cache-dir"});
+    args::ValueFlag<int>  argL1CacheMB(parser, "int", "Size limit in MB of the files in --l1-cache-dir, the least recently used ones are removed. Default: no limit.", {"l1-cache-mb"});
+    args::ValueFlag<int>  argLoadIOThreads(parser, "int", "how many files to load concurrently when the server starts, default = qthread.", {"io-threads"});
+    args::ValueFlag<string> argHugePages(parser, "string", "Allocate the large arrays of the map on huge pages: none (default), thp (transparent), 2m or 1g (explicit, falling back to thp; 1g uses 2m pages for the arrays well below 1 GiB).", {"huge-pages"});
+    args::Flag argNuma(parser, "numa", "Replicate the L1 node on each NUMA node, and pin the server threads to the NUMA nodes.", {"numa"});
     args::ValueFlag<int>  argSampleIndex(parser, "int", "printout kmers that matches a sample with index.", {"print-kmers-index"});
 
     try
@@ -362,7 +367,25 @@ int main(int argc, char ** argv) {
     string filename = args::get(argSeqOthName);
     if (*(filename.rbegin()) != '/') 
         filename = filename + "/";
+    if (argHugePages) {
+        map<string, int> modes = {{"none", HUGEPAGE_NONE}, {"thp", HUGEPAGE_TRANSPARENT}, {"2m", HUGEPAGE_2M}, {"1g", HUGEPAGE_1G}};
+        if (modes.count(args::get(argHugePages)) == 0) {
+            std::cerr << "--huge-pages must be none, thp, 2m or 1g." << std::endl;
+            return 1;
+        }
+        hugePageMode() = modes[args::get(argHugePages)];
+    }
     seqoth = make_shared<SeqOthello> (filename, nqueryThreads ,false);
+    if (argL1CacheDir)
+        seqoth->l1SharedCacheDir = args::get(argL1CacheDir);
+    if (argL1CacheMB)
+        seqoth->l1SharedCacheBytes = ((uint64_t) args::get(argL1CacheMB)) << 20;
+    if (argLoadIOThreads)
+        seqoth->loadIOThreads = args::get(argLoadIOThreads);
+    if (argNuma) {
+        numaNodes = numaNodesWithCPUs();
+        seqoth->l1NumaReplicas = true;
+    }
     if (argStartServer) {
         printf("Load SeqOthello. \n");
         seqoth->loadAll(nqueryThreads);
@@ -426,9 +449,9 @@ int main(int argc, char ** argv) {
     vector<shared_ptr<vector<uint32_t>>> vL2TID(vnodecnt, nullptr);
     vector<shared_ptr<vector<uint32_t>>> vL2KmerPosInTranscript(vnodecnt, nullptr);
     uint32_t L2IDShift = seqoth->L2IDShift;
-    map<int, vector<int> *> ans;
-    for (unsigned int i = 0 ; i < nSeq; i++)
-        ans.emplace(i, new vector<int> (seqoth->L2IDShift));
+    //! the sample counts of transcript i are ans[i*ansStride ...].
+    unsigned int ansStride = max(L2IDShift, seqoth->sampleCount + 1);
+    vector<int> ans((size_t) nSeq * ansStride, 0);
 
 //    vector<shared_ptr<unordered_map<int, vector<int>>>> response;
     vector<vector<uint64_t>> seqInKmers;
@@ -478,16 +501,14 @@ int main(int argc, char ** argv) {
     auto L1Resp = seqoth->QueryL1ByPartition(seqInKmers, nqueryThreads);
     vector<shared_ptr<vector<int>>> ansSampleDetails(vSeq.size(), nullptr);
     for (unsigned int i = 0; i < L1Resp.size(); i++) {
+        int *row = &ans[(size_t) i * ansStride];
+        const uint16_t *resp = L1Resp[i].data();
         for (unsigned int j = 0; j < L1Resp[i].size(); j++) {
-            uint16_t othquery = L1Resp[i].at(j);
+            uint16_t othquery = resp[j];
             if (othquery ==0) continue;
             if (othquery < L2IDShift) {
-                ans.find(i)->second->at(othquery-1) ++;
-                if (argShowDedatils) {
-                    string str(seqoth->sampleCount,'.');
-                    str[othquery-1] = '+';
-                    detailans[i][j] = make_shared<string>(str);
-                }
+                //! the single sample hits are printed from L1Resp in the detailed output.
+                row[othquery-1] ++;
                 if (showSampleIndex >=0)
                     if (othquery-1 == showSampleIndex) {
                         if (ansSampleDetails[i] == nullptr)
@@ -509,7 +530,8 @@ int main(int argc, char ** argv) {
                 vL2KmerPosInTranscript[othquery - L2IDShift]->push_back(j);
         }
     }
-    L1Resp.clear();
+    if (!argShowDedatils)
+        L1Resp.clear();
     ThreadPool pool(nqueryThreads, 1024);
     std::vector<std::future<int>> results;
     if (argSampleIndex) {
@@ -564,6 +586,7 @@ int main(int argc, char ** argv) {
                               std::ref(*vL2KmerPosInTranscript[i]),
                               std::ref(detailans),
                               std::ref(ans),
+                              ansStride,
                               ((bool) argShowDedatils),
                               seqoth->sampleCount,
                               std::ref(pool.write_mutex)
@@ -580,6 +603,7 @@ int main(int argc, char ** argv) {
         ConstantLengthKmerHelper<uint64_t, uint16_t> helper(kmerLength,0);
         char buf[32];
         memset(buf,0,sizeof(buf));
+        string nohit(seqoth->sampleCount,'.'), single(nohit);
         for (unsigned int i = 0 ; i < seqInKmers.size(); i++) {
             vector<shared_ptr<string>> &vans = detailans[i];
             for (unsigned int j = 0 ; j < seqInKmers[i].size(); j++) {
@@ -588,30 +612,36 @@ int main(int argc, char ** argv) {
                     if (usedreverse[i][j])
                         key = helper.reverseComplement(key);
                 helper.convertstring(buf,&key);
+                uint16_t othquery = L1Resp[i][j];
                 if (vans[j])  {
                     string str = *(vans[j].get());
                     fprintf(fout, "%s %s\n", buf, str.c_str());
                 }//detailans[i].at(j).get()->c_str());
+                else if (othquery > 0 && othquery < L2IDShift) {
+                    single[othquery-1] = '+';
+                    fprintf(fout, "%s %s\n", buf, single.c_str());
+                    single[othquery-1] = '.';
+                }
                 else {
-                    fprintf(fout, "%s %s\n", buf, string(seqoth->sampleCount,'.').c_str());
+                    fprintf(fout, "%s %s\n", buf, nohit.c_str());
                 }
             }
         }
     } else {
         int skippedcount = 0;
-        for (auto &res : ans) {
-            while (skipped.count(res.first + skippedcount)) {
-                fprintf(fout,"transcript# %d\t", res.first+skippedcount);
+        for (unsigned int r = 0 ; r < nSeq; r++) {
+            while (skipped.count(r + skippedcount)) {
+                fprintf(fout,"transcript# %d\t", r+skippedcount);
                 for (unsigned int i = 0 ; i < seqoth->sampleCount; i++)
                     fprintf(fout, "0\t");
                 fprintf(fout,"\n");
                 skippedcount ++;
             }
-            fprintf(fout,"transcript# %d\t", res.first+skippedcount);
+            fprintf(fout,"transcript# %d\t", r+skippedcount);
+            const int *row = &ans[(size_t) r * ansStride];
             for (unsigned int i = 0 ; i < seqoth->sampleCount; i++)
-                fprintf(fout, "%d\t", (*res.second)[i]);
+                fprintf(fout, "%d\t", row[i]);
             fprintf(fout, "\n");
-            delete res.second;
         }
         /*
         for (int i = 0 ; i < response.size(); i++) {
@@ -2,8 +2,10 @@
 #include "testL1Node.h"
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <random>
 #include <algorithm>
+#include <dirent.h>
 
 L1NodeTest::L1NodeTest() {}
 L1NodeTest::~L1NodeTest() {}
@@ -11,6 +13,51 @@ L1NodeTest::~L1NodeTest() {}
 void L1NodeTest::SetUp() {}
 void L1NodeTest::TearDown() {}
 
+vector<uint64_t> L1NodeTest::randomKeys(int n) {
+    vector<uint64_t> k;
+    for (int i = 0 ; i < n ; i++)
+         k.push_back(((uint64_t) rand() << 8) ^ rand());
+    sort(k.begin(), k.end());
+    k.erase(unique(k.begin(), k.end()), k.end());
+    return k;
+}
+
+L1Node * L1NodeTest::addKeys(const vector<uint64_t> &k, const string &name, function<void(L1Node *)> setup, function<uint16_t(uint64_t)> value) {
+    L1Node * p = new L1Node(1048576*128*4, 20, name + "tmp");
+    if (setup)
+        setup(p);
+    for (uint64_t key : k)
+        p->add(key, value(key));
+    return p;
+}
+
+L1Node * L1NodeTest::writeL1(L1Node *p, const string &name, unsigned int threads) {
+    vector<uint64_t> b = p->getBoundaries();
+    p->constructAndWrite(13, threads, name);
+    L1Node *q = new L1Node();
+    q->setsplitbit(20, p->getsplitbit());
+    q->setBoundaries(b);
+    q->setfname(name);
+    delete p;
+    return q;
+}
+
+L1Node * L1NodeTest::writeAndLoad(L1Node *p, const string &name, unsigned int threads, unsigned int loadThreads) {
+    L1Node *q = writeL1(p, name, threads);
+    q->loadFromFile(name, loadThreads);
+    return q;
+}
+
+int L1NodeTest::mismatches(L1Node *q, const vector<uint64_t> &k, function<uint16_t(uint64_t)> value) {
+    vector<uint64_t> res(k.size());
+    q->queryBatch(&k[0], k.size(), &res[0]);
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < k.size(); i++)
+        if (res[i] != value(k[i]) || q->queryInt(k[i]) != res[i])
+            uneq++;
+    return uneq;
+}
+
 TEST_F(L1NodeTest, TestL1BuildQuery) {
     int n = 100;
     vector<uint64_t> k;
@@ -40,6 +87,227 @@ TEST_F(L1NodeTest, TestL1BuildQuery) {
     }
     EXPECT_EQ(uneq,0);
 }
+
+TEST_F(L1NodeTest, TestL1LoadMapped) {
+    vector<uint64_t> k = randomKeys(1000);
+    auto value = [](uint64_t key) -> uint16_t {
+        return (key * 7) & 0xFF;
+    };
+    L1Node *q = writeAndLoad(addKeys(k, "testmap", nullptr, value), "testmap", 4);
+    int mapped = 0;
+    for (auto oth : q->othellos)
+        if (oth != NULL && oth->mem.isMapped())
+            mapped++;
+    EXPECT_GT(mapped, 0);
+    // the keys dropped by L1 parts are kept in their overflow tables.
+    EXPECT_EQ(mismatches(q, k, value), 0);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1ParallelLoad) {
+    vector<uint64_t> k = randomKeys(1000);
+    L1Node *q = writeAndLoad(addKeys(k, "testplload"), "testplload", 4, 3);
+    EXPECT_EQ(q->othellos.size(), 1U << q->getsplitbit());
+    EXPECT_EQ(mismatches(q, k), 0);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1BuildBudget) {
+    vector<uint64_t> k = randomKeys(3000);
+    L1Node *p = addKeys(k, "testbudget", [](L1Node *p) {
+        // every part is over budget, so they are built one at a time.
+        p->buildMemoryBytes = 1;
+    });
+    L1Node *q = writeAndLoad(p, "testbudget", 3);
+    EXPECT_EQ(mismatches(q, k), 0);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1Balanced) {
+    // most keys share a prefix, as with poly-A k-mers.
+    vector<uint64_t> k = randomKeys(300);
+    for (int i = 0 ; i < 3000 ; i++)
+         k.push_back(rand() & 0xFFFFF);
+    sort(k.begin(), k.end());
+    k.erase(unique(k.begin(), k.end()), k.end());
+    L1Node *p = addKeys(k, "testbalanced", [&](L1Node *p) {
+        p->balanced = true;
+        p->partTarget = k.size() / 4 + 1;
+    });
+    for (auto *kv : p->kV)
+        EXPECT_LE(kv->size(), k.size() / 4 + 1);
+    L1Node *q = writeAndLoad(p, "testbalanced");
+    EXPECT_EQ(q->getBoundaries().size(), 4U);
+    EXPECT_EQ(mismatches(q, k), 0);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1PartValueWidth) {
+    vector<uint64_t> k = randomKeys(2000);
+    auto value = [](uint64_t key) -> uint16_t {
+        const uint16_t vals[] = {3, 1000, 5000};
+        return vals[key % 3];
+    };
+    L1Node *q = writeAndLoad(addKeys(k, "testwidth", nullptr, value), "testwidth");
+    for (auto oth : q->othellos)
+        if (oth != NULL) {
+            EXPECT_EQ(oth->L, 2U);
+            EXPECT_EQ(oth->valueMap.size(), 4U);
+        }
+    EXPECT_EQ(mismatches(q, k, value), 0);
+    // keys not in the map get 0 as often as from a part of the same width without codes.
+    L1Node *r = writeAndLoad(addKeys(k, "testwidthraw", nullptr, [](uint64_t key) -> uint16_t {
+        return key % 3 + 1;
+    }), "testwidthraw");
+    for (auto oth : r->othellos)
+        if (oth != NULL) {
+            EXPECT_EQ(oth->L, 2U);
+            EXPECT_TRUE(oth->valueMap.empty());
+        }
+    vector<uint64_t> alien;
+    for (uint64_t x : randomKeys(20000))
+        if (!binary_search(k.begin(), k.end(), x))
+            alien.push_back(x);
+    vector<uint64_t> res(alien.size()), raw(alien.size());
+    q->queryBatch(&alien[0], alien.size(), &res[0]);
+    r->queryBatch(&alien[0], alien.size(), &raw[0]);
+    double zeros = count(res.begin(), res.end(), 0) / (double) alien.size();
+    double rawZeros = count(raw.begin(), raw.end(), 0) / (double) alien.size();
+    EXPECT_GT(rawZeros, 0.05);
+    EXPECT_NEAR(zeros, rawZeros, 0.05);
+    delete q;
+    delete r;
+}
+TEST_F(L1NodeTest, TestL1Replicate) {
+    vector<uint64_t> k = randomKeys(1000);
+    L1Node *q = writeAndLoad(addKeys(k, "testreplica"), "testreplica");
+    EXPECT_THROW(q->replicate({0}), std::invalid_argument);
+    // replicas on node 0, and on a node that may not exist, as with sparse node ids.
+    q->replicate({0, 2});
+    int uneq = 0;
+    for (int node : {0, 1, 2}) {
+        std::thread([&]() {
+            pinToNumaNode(node);
+            uneq += mismatches(q, k);
+        }).join();
+    }
+    EXPECT_EQ(uneq, 0);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1QueryBatch) {
+    vector<uint64_t> k = randomKeys(1000);
+    L1Node *q = writeAndLoad(addKeys(k, "testbatch"), "testbatch", 4);
+    EXPECT_EQ(mismatches(q, k), 0);
+    // keys not in the node get the same value from both.
+    vector<uint64_t> alien = randomKeys(100);
+    vector<uint64_t> res(alien.size());
+    q->queryBatch(&alien[0], alien.size(), &res[0]);
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < alien.size(); i++)
+        if (res[i] != q->queryInt(alien[i]))
+            uneq++;
+    EXPECT_EQ(uneq, 0);
+    // a batch of the keys of one part, and an empty batch.
+    vector<uint64_t> one;
+    for (uint64_t key : k)
+        if (q->partOf(key) == q->partOf(k[0]))
+            one.push_back(key);
+    EXPECT_LT(one.size(), k.size());
+    EXPECT_EQ(mismatches(q, one), 0);
+    q->queryBatch(NULL, 0, NULL);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1QueryByPart) {
+    vector<uint64_t> k = randomKeys(2000);
+    L1Node *q = writeL1(addKeys(k, "testbypart"), "testbypart", 4);
+    EXPECT_GT(q->getsplitbit(), 0U);
+    // transcripts of shuffled k-mers, spanning all parts.
+    vector<vector<uint64_t>> kmers(7);
+    for (unsigned int i = 0 ; i < k.size(); i++)
+        kmers[(i * 5) % 7].push_back(k[k.size() - 1 - i]);
+    vector<vector<uint16_t>> ans;
+    for (auto &vk : kmers)
+        ans.push_back(vector<uint16_t>(vk.size()));
+    q->queryByPartAndPutToVV(ans, kmers, 2);
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < kmers.size(); i++)
+        for (unsigned int j = 0 ; j < kmers[i].size(); j++)
+            if (ans[i][j] != keyValue(kmers[i][j]))
+                uneq++;
+    EXPECT_EQ(uneq, 0);
+    delete q;
+}
+TEST_F(L1NodeTest, TestL1PartCache) {
+    vector<uint64_t> k = randomKeys(2000);
+    L1Node *written = writeL1(addKeys(k, "testcache"), "testcache", 4);
+    uint32_t splitbit = written->getsplitbit();
+    delete written;
+    // compress the parts, as written by older versions.
+    for (uint32_t g = 0; g < (1U << splitbit); g++) {
+        string part = "testcache." + to_string(g);
+        unsigned char buf[0x20];
+        gzFile fin = gzopen(part.c_str(), "rb");
+        gzread(fin, buf, sizeof(buf));
+        Othello<uint64_t> oth(buf);
+        oth.loadDataFromFile(fin, part.c_str());
+        gzclose(fin);
+        // the part is mapped, write a new file instead of truncating it.
+        gzFile fout = gzopen((part + ".gz").c_str(), "wb");
+        gzwrite(fout, buf, sizeof(buf));
+        oth.writeDataToGzipFile(fout);
+        gzclose(fout);
+        rename((part + ".gz").c_str(), part.c_str());
+    }
+    vector<vector<uint64_t>> kmers(1, k);
+    int unlimited = 0;
+    for (uint64_t budget : {0, 1}) {
+        system("rm -rf testl1cache; mkdir testl1cache");
+        L1Node *q = new L1Node();
+        q->setsplitbit(20, splitbit);
+        q->setfname("testcache");
+        q->sharedCacheDir = "testl1cache";
+        q->sharedCacheBytes = budget;
+        for (int r = 0; r < 2; r++) {
+            vector<vector<uint16_t>> ans(1, vector<uint16_t>(k.size()));
+            q->queryByPartAndPutToVV(ans, kmers, 2);
+            int uneq = 0;
+            for (unsigned int i = 0 ; i < k.size(); i++)
+                if (ans[0][i] != keyValue(k[i]))
+                    uneq++;
+            EXPECT_EQ(uneq, 0) << "budget=" << budget << " round=" << r;
+        }
+        delete q;
+        int files = 0;
+        DIR *d = opendir("testl1cache");
+        while (struct dirent *e = readdir(d))
+            if (strncmp(e->d_name, "seqoth_L1", 9) == 0)
+                files++;
+        closedir(d);
+        if (budget)
+            EXPECT_EQ(files, min(unlimited, 1));
+        else
+            unlimited = files;
+    }
+    EXPECT_GT(unlimited, 0);
+}
+TEST_F(L1NodeTest, TestIOBufSpill) {
+    uint64_t budget = IOBufStager::get().budget;
+    uint32_t maxInflight = IOBufStager::get().maxInflight;
+    // room for 3 chunks of keys, the others are written to the file, with at most 2 waiting.
+    IOBufStager::get().budget = 3 * 8192 * sizeof(uint64_t);
+    IOBufStager::get().maxInflight = 2;
+    IOBuf<uint64_t> *b = new IOBuf<uint64_t>("testiobuf.keys");
+    size_t n = 100000;
+    for (size_t i = 0; i < n; i++)
+        b->push_back(i * 7);
+    EXPECT_EQ(b->size(), n);
+    uint64_t *p = b->getstart();
+    int uneq = 0;
+    for (size_t i = 0; i < n; i++)
+        if (p[i] != i * 7)
+            uneq++;
+    EXPECT_EQ(uneq, 0);
+    delete b;
+    IOBufStager::get().budget = budget;
+    IOBufStager::get().maxInflight = maxInflight;
+}
+
 /*
 void testVAL(vector<uint32_t> val) {
 
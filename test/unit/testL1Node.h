@@ -1,6 +1,12 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include "gtest/gtest.h"
+#include <vector>
+#include <string>
+#include <functional>
+#include <cstdint>
+
+class L1Node;
 
 // The fixture for testing class Foo.
 class L1NodeTest : public ::testing::Test {
@@ -24,4 +30,19 @@ protected:
     // before the destructor).
     virtual void TearDown();
 
+    //! n random keys, sorted and unique.
+    static std::vector<uint64_t> randomKeys(int n);
+    //! the value of key k, as added by addKeys() by default.
+    static uint16_t keyValue(uint64_t k) {
+        return (k * 7) & 0xFFF;
+    }
+    //! a new L1 node, named name, with the options set by setup, and the keys k added with their values.
+    static L1Node * addKeys(const std::vector<uint64_t> &k, const std::string &name,
+                            std::function<void(L1Node *)> setup = nullptr, std::function<uint16_t(uint64_t)> value = keyValue);
+    //! build and write the L1 node p to name with threads threads, delete it, and return a node of the files, whose parts are loaded on demand.
+    static L1Node * writeL1(L1Node *p, const std::string &name, unsigned int threads = 2);
+    //! writeL1(), with all parts loaded from the files.
+    static L1Node * writeAndLoad(L1Node *p, const std::string &name, unsigned int threads = 2, unsigned int loadThreads = 1);
+    //! the number of keys k for which queryBatch() or queryInt() of q do not return their values.
+    static int mismatches(L1Node *q, const std::vector<uint64_t> &k, std::function<uint16_t(uint64_t)> value = keyValue);
 };
@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <random>
+#include <set>
 
 L2NodeTest::L2NodeTest() {
 
@@ -46,6 +47,77 @@ TEST_F(L2NodeTest, TestEncodeDecode) {
    testVAL(val1);
 }
 
+TEST_F(L2NodeTest, TestDecodeSum) {
+    for (int i = 0 ; i < 1000; i++) {
+        vector<uint32_t> val;
+        while (val.size() < 40) {
+            int kind = rand() % 4;
+            if (kind == 0)
+                val.insert(val.end(), 1 + rand() % 20, 1);
+            else if (kind == 1)
+                val.push_back(rand() % 8);
+            else
+                val.push_back(rand() % (1 << (4 * kind + 4)));
+        }
+        vector<uint8_t> buf(256,0);
+        uint32_t q = valuelistEncode(&buf[0], val, true);
+        // decode from a row of exactly the encoded length, the decoder must not read past it.
+        vector<uint8_t> row(buf.begin(), buf.begin() + q);
+        vector<uint32_t> gaps, sums;
+        valuelistDecode(&row[0], gaps, q);
+        EXPECT_EQ(gaps, val);
+        valuelistDecodeSum(&row[0], sums, q);
+        uint32_t last = 0;
+        for (auto &v : val)
+            v = (last += v);
+        EXPECT_EQ(sums, val);
+    }
+}
+
+TEST_F(L2NodeTest, TestValueListCount) {
+    vector<uint32_t> samples = {0, 3, 4, 5, 6, 7, 8, 9, 10, 11, 100, 2000, 70000};
+    vector<uint32_t> val;
+    uint32_t last = 0;
+    for (auto s : samples) {
+        val.push_back(s - last);
+        last = s;
+    }
+    vector<uint8_t> buf(64,0);
+    uint32_t q = valuelistEncode(&buf[0], val, true);
+    vector<int> counts(3000, 1);
+    EXPECT_EQ(valuelistCount(&buf[0], q, &counts[0], counts.size()), samples.size());
+    for (uint32_t s = 0; s < counts.size(); s++)
+        EXPECT_EQ(counts[s], 1 + (int) count(samples.begin(), samples.end(), s));
+}
+
+TEST_F(L2NodeTest, TestBitmapAccumulate) {
+    uint32_t nbits = 2653;
+    vector<uint8_t> row(nbits / 8 + 1);
+    for (auto &b : row)
+        b = rand();
+    vector<int> counts(nbits + 8, 2);
+    bitmapAccumulate(&row[0], nbits, &counts[0]);
+    for (uint32_t v = 0; v < counts.size(); v++)
+        EXPECT_EQ(counts[v], 2 + (v < nbits && (row[v >> 3] & (1 << (v & 7)))));
+}
+
+TEST_F(L2NodeTest, TestRowDedup) {
+    uint32_t rowbytes = 13;
+    RowDedup dedup(rowbytes);
+    map<vector<uint8_t>, uint32_t> expected;
+    for (uint32_t i = 0; i < 20000; i++) {
+        vector<uint8_t> row(rowbytes, 0);
+        row[rand() % rowbytes] = rand() % 64;
+        row[rowbytes - 1] = rand() % 64;
+        bool fresh;
+        uint32_t id = dedup.insert(&row[0], expected.size() + 1, fresh);
+        EXPECT_EQ(fresh, expected.count(row) == 0);
+        if (fresh)
+            expected[row] = id;
+        EXPECT_EQ(id, expected[row]);
+    }
+}
+
 TEST_F(L2NodeTest, TestL2Short) {
     
     L2Node *N = new L2ShortValueListNode (5,8,"test.gz");
@@ -95,6 +167,67 @@ TEST_F(L2NodeTest, TestL2Short) {
     }
 }
 
+//! add NN rows of *valuecnt* values of *maxnl* bits, write and load them, and query every row of the loaded node.
+void testShortRoundTrip(uint32_t valuecnt, uint32_t maxnl, string fname) {
+    uint32_t mask = (1U << maxnl) - 1;
+    unsigned int NN = 200;
+    std::mt19937_64 gen(valuecnt * 64 + maxnl);
+    set<uint64_t> distinct;
+    vector<uint64_t> vK;
+    while (vK.size() < NN) {
+        uint64_t k = gen() & 0xFFFFFFFFFFFFULL;
+        if (distinct.insert(k).second)
+            vK.push_back(k);
+    }
+    // every row starts with an all-ones value, so that the bytes of the next row leak into a row read past its end,
+    // and the last rows are all ones, to read the tail of the file into the padding.
+    auto rowOf = [&](uint64_t i) {
+        vector<uint32_t> v(valuecnt, mask);
+        if (i + 2 < NN)
+            for (uint32_t j = 1; j < valuecnt; j++)
+                v[j] = (i * 31 + j * 7) & mask;
+        return v;
+    };
+    L2ShortValueListNode *N = new L2ShortValueListNode(valuecnt, maxnl, fname);
+    for (uint64_t i = 0; i < NN; i++) {
+        vector<uint32_t> v = rowOf(i);
+        N->add(vK[i], v);
+    }
+    N->constructOth();
+    N->writeDataToGzipFile();
+    delete N;
+
+    L2ShortValueListNode *N2 = new L2ShortValueListNode(valuecnt, maxnl, fname);
+    N2->loadDataFromGzipFile();
+    vector<int> counts(mask + 2);
+    for (uint64_t i = 0; i < NN; i++) {
+        vector<uint32_t> vret;
+        vector<uint8_t> vretmap;
+        EXPECT_TRUE(N2->smartQuery(&vK[i], vret, vretmap));
+        EXPECT_EQ(vret, rowOf(i));
+        fill(counts.begin(), counts.end(), 0);
+        N2->smartCount(&vK[i], &counts[0], mask + 1);
+        for (uint32_t v : vret)
+            counts[v]--;
+        EXPECT_EQ(counts, vector<int>(mask + 2, 0));
+    }
+    // the two all-ones rows are stored once, after NN - 1 distinct rows and the empty row 0.
+    vector<uint32_t> vret;
+    vector<uint8_t> vretmap;
+    N2->queryByIndex(NN - 1, vret, vretmap);
+    EXPECT_EQ(vret, rowOf(NN - 1));
+    N2->queryByIndex(NN, vret, vretmap);
+    EXPECT_TRUE(vret.empty());
+    delete N2;
+}
+
+TEST_F(L2NodeTest, TestL2ShortRoundTrip) {
+    testShortRoundTrip(3, 10, "testshort4.gz");
+    testShortRoundTrip(5, 8, "testshort5.gz");
+    testShortRoundTrip(8, 8, "testshort8.gz");
+    testShortRoundTrip(4, 16, "testshort8w.gz");
+}
+
 TEST_F(L2NodeTest, TestL2MAPP) {
     std::random_device rd;  //Will be used to obtain a seed for the random number engine
     std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
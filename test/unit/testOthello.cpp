@@ -0,0 +1,183 @@
+#include <othello.h>
+#include "testOthello.h"
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <set>
+
+OthelloTest::OthelloTest() {}
+OthelloTest::~OthelloTest() {}
+
+void OthelloTest::SetUp() {}
+void OthelloTest::TearDown() {}
+
+vector<uint64_t> OthelloTest::randomKeys(int n) {
+    vector<uint64_t> k;
+    for (int i = 0 ; i < n ; i++)
+         k.push_back(((uint64_t) rand() << 24) ^ rand());
+    sort(k.begin(), k.end());
+    k.erase(unique(k.begin(), k.end()), k.end());
+    return k;
+}
+
+vector<uint32_t> OthelloTest::keyValues(const vector<uint64_t> &k, uint32_t mask) {
+    vector<uint32_t> v;
+    for (auto x : k)
+        v.push_back((x * 7) & mask);
+    return v;
+}
+
+Othello<uint64_t> * OthelloTest::writeAndLoad(Othello<uint64_t> &oth, const char *fname, const char *mode) {
+    unsigned char buf[0x20];
+    oth.exportInfo(buf);
+    gzFile fout = gzopen(fname, mode);
+    gzwrite(fout, buf, sizeof(buf));
+    // compressed files are written without the padding for mapping.
+    if (strcmp(mode, "wbT") == 0)
+        oth.writeDataToMappableFile(fout);
+    else
+        oth.writeDataToGzipFile(fout);
+    gzclose(fout);
+    gzFile fin = gzopen(fname, "rb");
+    gzread(fin, buf, sizeof(buf));
+    Othello<uint64_t> *loaded = new Othello<uint64_t>(buf);
+    loaded->loadDataFromFile(fin, fname);
+    gzclose(fin);
+    return loaded;
+}
+
+int OthelloTest::mismatches(Othello<uint64_t> &oth, const vector<uint64_t> &k, const vector<uint32_t> &v) {
+    vector<uint64_t> res(k.size());
+    oth.queryBatch(&k[0], k.size(), &res[0]);
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < k.size(); i++)
+        if (res[i] != v[i] || oth.queryInt(k[i]) != v[i])
+            uneq++;
+    return uneq;
+}
+
+TEST_F(OthelloTest, TestOthelloConcurrentBuild) {
+    vector<uint64_t> k = randomKeys(200000);
+    vector<uint32_t> v = keyValues(k, 0xFFFF);
+    Othello<uint64_t> oth(16, k, v, true, 200, 4);
+    EXPECT_TRUE(oth.build);
+    set<uint64_t> removed(oth.removedKeys.begin(), oth.removedKeys.end());
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < k.size(); i++)
+        if (removed.count(k[i]) == 0 && oth.queryInt(k[i]) != v[i])
+            uneq++;
+    EXPECT_EQ(uneq, 0);
+    // cells of no key stay 0, as when built by one thread.
+    Othello<uint64_t> one(16, k, v, true, 200, 1);
+    int zeros = 0, oneZeros = 0;
+    for (int i = 0; i < 20000; i++) {
+        uint64_t x = ((uint64_t) rand() << 24) ^ rand();
+        zeros += oth.queryInt(x) == 0;
+        oneZeros += one.queryInt(x) == 0;
+    }
+    EXPECT_GT(oneZeros, 1000);
+    EXPECT_NEAR(zeros, oneZeros, 1000);
+}
+TEST_F(OthelloTest, TestOthelloGatherWidths) {
+    vector<uint64_t> k = randomKeys(3000);
+    for (uint32_t L : {1, 2, 3, 5, 8, 11, 13, 16, 19, 24, 29, 32}) {
+        vector<uint32_t> v = keyValues(k, (1ULL << L) - 1);
+        Othello<uint64_t> oth(L, k, v, true, 0);
+        EXPECT_EQ(mismatches(oth, k, v), 0) << "L=" << L;
+    }
+}
+TEST_F(OthelloTest, TestOthelloRangeSizing) {
+    vector<uint64_t> k = randomKeys(100000);
+    vector<uint32_t> v = keyValues(k, 0xFFFF);
+    Othello<uint64_t> oth(16, k, v, true, 0);
+    EXPECT_TRUE(oth.build);
+    EXPECT_LT((uint64_t) oth.ma + oth.mb, k.size() * 3);
+    unsigned char buf[0x20];
+    oth.exportInfo(buf);
+    Othello<uint64_t> info(buf);
+    EXPECT_EQ(info.ma, oth.ma);
+    EXPECT_EQ(info.mb, oth.mb);
+    vector<uint32_t> bha(k.size()), bhb(k.size());
+    info.get_hash_batch(&k[0], k.size(), &bha[0], &bhb[0]);
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < k.size(); i++) {
+        uint32_t ha, hb;
+        info.get_hash(k[i], ha, hb);
+        if (ha != bha[i] || hb != bhb[i] || ha >= oth.ma || hb >= oth.ma + oth.mb || oth.queryInt(k[i]) != v[i])
+            uneq++;
+    }
+    EXPECT_EQ(uneq, 0);
+}
+TEST_F(OthelloTest, TestOthelloBlockedLayout) {
+    vector<uint64_t> k = randomKeys(20000);
+    vector<uint32_t> v = keyValues(k, 0x1FFF);
+    for (uint32_t blockbytes : {64, 4096}) {
+        Othello<uint64_t> oth(13, k, v, true, 0, 2, blockbytes);
+        EXPECT_TRUE(oth.build);
+        Othello<uint64_t> *loaded = writeAndLoad(oth, "testblocked");
+        EXPECT_TRUE(loaded->loaded);
+        EXPECT_EQ(loaded->blockbytes, blockbytes);
+        EXPECT_EQ(mismatches(*loaded, k, v), 0) << "blockbytes=" << blockbytes;
+        delete loaded;
+    }
+}
+TEST_F(OthelloTest, TestOthelloHugePages) {
+    vector<uint64_t> k = randomKeys(600000);
+    vector<uint32_t> v = keyValues(k, 0xFFFF);
+    Othello<uint64_t> oth(16, k, v, true, 200);
+    // explicit huge pages fall back to transparent ones if none are reserved.
+    hugePageMode() = HUGEPAGE_2M;
+    Othello<uint64_t> *loaded = writeAndLoad(oth, "testhugepages");
+    vector<uint64_t, LargePageAllocator<uint64_t>> list;
+    for (size_t i = 0; i < k.size(); i++)
+        list.push_back(i);
+    hugePageMode() = HUGEPAGE_NONE;
+    EXPECT_TRUE(loaded->loaded);
+    EXPECT_TRUE(loaded->mem.isAnonymous());
+    EXPECT_FALSE(loaded->mem.isMapped());
+    vector<uint64_t> res(k.size());
+    loaded->queryBatch(&k[0], k.size(), &res[0]);
+    int uneq = 0;
+    for (unsigned int i = 0 ; i < k.size(); i++)
+        if (res[i] != oth.queryInt(k[i]) || list[i] != i)
+            uneq++;
+    EXPECT_EQ(uneq, 0);
+    delete loaded;
+}
+TEST_F(OthelloTest, TestOthelloOverflow) {
+    vector<uint64_t> k = randomKeys(10000);
+    // a repeated key closes a cycle, and is removed.
+    for (int i = 0 ; i < 50; i++)
+        k.push_back(k[i * 7]);
+    vector<uint32_t> v = keyValues(k, 0xFFF);
+    for (uint32_t hashes : {2, 3}) {
+        Othello<uint64_t> *oth;
+        if (hashes == 3)
+            oth = new Othello3<uint64_t>(12, k, v, true, 200);
+        else
+            oth = new Othello<uint64_t>(12, k, v, true, 200);
+        EXPECT_TRUE(oth->build);
+        EXPECT_GE(oth->removedKeys.size(), 50U);
+        for (const char *mode : {"wbT", "wb"}) {
+            Othello<uint64_t> *loaded = writeAndLoad(*oth, "testoverflow", mode);
+            EXPECT_TRUE(loaded->loaded);
+            EXPECT_EQ(loaded->overflowKeys, oth->overflowKeys);
+            EXPECT_EQ(mismatches(*loaded, k, v), 0) << "hashes=" << hashes << " mode=" << mode;
+            delete loaded;
+        }
+        delete oth;
+    }
+}
+TEST_F(OthelloTest, TestOthello3) {
+    vector<uint64_t> k = randomKeys(50000);
+    vector<uint32_t> v = keyValues(k, 0x7FF);
+    Othello3<uint64_t> oth(11, k, v, true, 0);
+    EXPECT_TRUE(oth.build);
+    EXPECT_LT((uint64_t) oth.ma + oth.mb + oth.mc, k.size() * 1.4);
+    Othello<uint64_t> *loaded = writeAndLoad(oth, "testoth3");
+    EXPECT_TRUE(loaded->loaded);
+    EXPECT_EQ(loaded->mc, oth.mc);
+    EXPECT_EQ(mismatches(*loaded, k, v), 0);
+    delete loaded;
+}
@@ -0,0 +1,39 @@
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include "gtest/gtest.h"
+#include <vector>
+#include <cstdint>
+
+template <class keyType> class Othello;
+
+// The fixture for testing class Othello.
+class OthelloTest : public ::testing::Test {
+
+protected:
+
+    // You can do set-up work for each test here.
+    OthelloTest();
+
+    // You can do clean-up work that doesn't throw exceptions here.
+    virtual ~OthelloTest();
+
+    // If the constructor and destructor are not enough for setting up
+    // and cleaning up each test, you can define the following methods:
+
+    // Code here will be called immediately after the constructor (right
+    // before each test).
+    virtual void SetUp();
+
+    // Code here will be called immediately after each test (right
+    // before the destructor).
+    virtual void TearDown();
+
+    //! n random keys, sorted and unique.
+    static std::vector<uint64_t> randomKeys(int n);
+    //! the values (k * 7) & mask of the keys k.
+    static std::vector<uint32_t> keyValues(const std::vector<uint64_t> &k, uint32_t mask);
+    //! write oth to the file fname, gzip-compressed if mode is "wb", and return it loaded from the file.
+    static Othello<uint64_t> * writeAndLoad(Othello<uint64_t> &oth, const char *fname, const char *mode = "wbT");
+    //! the number of keys k for which queryBatch() or queryInt() of oth do not return v.
+    static int mismatches(Othello<uint64_t> &oth, const std::vector<uint64_t> &k, const std::vector<uint32_t> &v);
+};